@@ -0,0 +1,399 @@
+//
+// bench.cpp
+// Put/Get throughput and latency benchmarks (Google Benchmark).
+//
+// Machine-readable results:
+//   BenchISplitter --benchmark_out=results.json --benchmark_out_format=json
+//
+// Engine arguments: 0 - Queue, 1 - Ring, 2 - LockFreeQueue.
+//
+
+#include "ISplitter.h"
+#include "ISplitter.cpp"
+#include "BufferPool.cpp"
+#include "LatencyHistogram.cpp"
+#include "Executor.cpp"
+#include "SpillFile.cpp"
+
+#include <benchmark/benchmark.h>
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <mutex>
+#include <cstring>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+const char* EngineName(ISplitter::Engine engine)
+{
+	switch (engine) {
+	case ISplitter::Engine::Queue: return "Queue";
+	case ISplitter::Engine::Ring: return "Ring";
+	case ISplitter::Engine::LockFreeQueue: return "LockFreeQueue";
+	}
+	return "";
+}
+
+DataPtr MakeFrame(size_t size)
+{
+	return std::make_shared<DataArray>(size);
+}
+
+// Consumer threads that keep draining their clients until stopped.
+class Consumers
+{
+public:
+	Consumers(const ISplitterPtr& splitter, const ClientIds& ids)
+	{
+		for (auto id : ids) {
+			mThreads.emplace_back([this, splitter, id] {
+				DataPtr data;
+				while (!mStop) {
+					if (!splitter->Get(id, data, 10))
+						mReceived.fetch_add(1, memory_order_relaxed);
+				}
+			});
+		}
+	}
+
+	~Consumers()
+	{
+		Stop();
+	}
+
+	void Stop()
+	{
+		mStop = true;
+		for (auto& thread : mThreads) {
+			if (thread.joinable())
+				thread.join();
+		}
+	}
+
+	size_t Received() const { return mReceived; }
+
+private:
+	std::vector<std::thread> mThreads;
+	std::atomic_bool mStop{ false };
+	std::atomic<size_t> mReceived{ 0 };
+};
+
+ClientIds AddClients(const ISplitterPtr& splitter, size_t count)
+{
+	ClientIds ids;
+	for (size_t i = 0; i < count; i++) {
+		uint32_t id;
+		if (splitter->ClientAdd(&id))
+			ids.push_back(id);
+	}
+	return ids;
+}
+
+double Percentile(std::vector<double>& samples, double p)
+{
+	if (samples.empty())
+		return 0;
+
+	auto index = static_cast<size_t>(p * (samples.size() - 1));
+	std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+	return samples[index];
+}
+
+} // namespace
+
+// Put throughput against the number of clients, every client drained by its own thread.
+static void BM_PutThroughput(benchmark::State& state)
+{
+	const auto engine = static_cast<ISplitter::Engine>(state.range(0));
+	const auto clientCount = static_cast<size_t>(state.range(1));
+
+	auto splitter = ISplitter::Create(16, clientCount, engine);
+	auto ids = AddClients(splitter, clientCount);
+	Consumers consumers(splitter, ids);
+
+	auto frame = MakeFrame(64);
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(splitter->Put(frame, -1));
+	}
+
+	consumers.Stop();
+
+	state.SetItemsProcessed(state.iterations());
+	state.SetLabel(EngineName(engine));
+}
+BENCHMARK(BM_PutThroughput)->ArgsProduct({ { 0, 1, 2 }, { 1, 2, 4, 8, 16, 32 } })->UseRealTime();
+
+// Producer-to-consumer handoff latency: one frame in flight, every client has to receive it
+// before the next one is put. Reports percentiles in microseconds.
+static void BM_GetLatency(benchmark::State& state)
+{
+	const auto engine = static_cast<ISplitter::Engine>(state.range(0));
+	const auto clientCount = static_cast<size_t>(state.range(1));
+
+	auto splitter = ISplitter::Create(16, clientCount, engine);
+	auto ids = AddClients(splitter, clientCount);
+
+	std::atomic_bool stop{ false };
+	std::atomic<size_t> received{ 0 };
+	std::mutex samplesMutex;
+	std::vector<double> samples;
+
+	std::vector<std::thread> threads;
+	for (auto id : ids) {
+		threads.emplace_back([&, id] {
+			std::vector<double> local;
+			DataPtr data;
+			while (!stop) {
+				if (splitter->Get(id, data, 10))
+					continue;
+
+				steady_clock::rep stamp;
+				std::memcpy(&stamp, data->data(), sizeof(stamp));
+				auto now = steady_clock::now().time_since_epoch().count();
+				local.push_back(duration<double, std::micro>(steady_clock::duration(now - stamp)).count());
+				received.fetch_add(1);
+			}
+
+			std::scoped_lock lock(samplesMutex);
+			samples.insert(samples.end(), local.begin(), local.end());
+		});
+	}
+
+	size_t expected = 0;
+	for (auto _ : state) {
+		auto frame = MakeFrame(sizeof(steady_clock::rep));
+		auto stamp = steady_clock::now().time_since_epoch().count();
+		std::memcpy(frame->data(), &stamp, sizeof(stamp));
+
+		splitter->Put(frame, -1);
+
+		expected += ids.size();
+		while (received.load() < expected)
+			std::this_thread::yield();
+	}
+
+	stop = true;
+	for (auto& thread : threads)
+		thread.join();
+
+	state.counters["p50_us"] = Percentile(samples, 0.50);
+	state.counters["p99_us"] = Percentile(samples, 0.99);
+	state.counters["p999_us"] = Percentile(samples, 0.999);
+	state.counters["max_us"] = samples.empty() ? 0 : *std::max_element(samples.begin(), samples.end());
+	state.SetLabel(EngineName(engine));
+}
+BENCHMARK(BM_GetLatency)->ArgsProduct({ { 0, 1, 2 }, { 1, 4, 16 } })->UseRealTime();
+
+// Frame size sweep, heap-allocated frames (0) against AcquireBuffer (1).
+static void BM_FrameSize(benchmark::State& state)
+{
+	const auto frameSize = static_cast<size_t>(state.range(0));
+	const bool pooled = state.range(1) != 0;
+
+	auto splitter = ISplitter::Create(4, 2);
+	auto ids = AddClients(splitter, 2);
+	Consumers consumers(splitter, ids);
+
+	for (auto _ : state) {
+		auto frame = pooled ? splitter->AcquireBuffer(frameSize) : MakeFrame(frameSize);
+		(*frame)[0] = 1;
+		(*frame)[frameSize - 1] = 1;
+		benchmark::DoNotOptimize(splitter->Put(frame, -1));
+	}
+
+	consumers.Stop();
+
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * frameSize);
+	state.SetLabel(pooled ? "pooled" : "heap");
+}
+BENCHMARK(BM_FrameSize)->ArgsProduct({ { 1 << 10, 64 << 10, 1 << 20, 8 << 20 }, { 0, 1 } })->UseRealTime();
+
+// One of four clients never reads: measures the cost of the drop path for the given put timeout.
+static void BM_SlowConsumer(benchmark::State& state)
+{
+	const auto engine = static_cast<ISplitter::Engine>(state.range(0));
+	const auto timeoutMsec = static_cast<int32_t>(state.range(1));
+
+	auto splitter = ISplitter::Create(8, 4, engine);
+	auto ids = AddClients(splitter, 4);
+	ClientIds readers(ids.begin() + 1, ids.end());
+	Consumers consumers(splitter, readers);
+
+	auto frame = MakeFrame(64);
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(splitter->Put(frame, timeoutMsec));
+	}
+
+	consumers.Stop();
+
+	size_t latency = 0;
+	size_t dropped = 0;
+	splitter->ClientGetById(ids[0], &latency, &dropped);
+
+	state.counters["dropped"] = static_cast<double>(dropped);
+	state.SetItemsProcessed(state.iterations());
+	state.SetLabel(EngineName(engine));
+}
+BENCHMARK(BM_SlowConsumer)->ArgsProduct({ { 0, 1, 2 }, { 0, 1 } })->UseRealTime();
+
+// Put cost while another thread keeps adding and removing clients. ClientRemove swaps in a new
+// client list without waiting for Put; a Put still walking the old list finds the removed client
+// flushed. The churned clients never read, so Put does not wait for free buffers here, which
+// would only measure how long a churned client lives.
+static void BM_ClientChurn(benchmark::State& state)
+{
+	const auto engine = static_cast<ISplitter::Engine>(state.range(0));
+
+	auto splitter = ISplitter::Create(16, 8, engine);
+	auto ids = AddClients(splitter, 4);
+	Consumers consumers(splitter, ids);
+
+	std::atomic_bool stop{ false };
+	std::atomic<size_t> churn{ 0 };
+	std::thread churnThread([&] {
+		while (!stop) {
+			uint32_t id;
+			if (splitter->ClientAdd(&id)) {
+				splitter->ClientRemove(id);
+				churn.fetch_add(1, memory_order_relaxed);
+			}
+		}
+	});
+
+	auto frame = MakeFrame(64);
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(splitter->Put(frame, 0));
+	}
+
+	stop = true;
+	churnThread.join();
+	consumers.Stop();
+
+	state.counters["add_remove"] = static_cast<double>(churn.load());
+	state.SetItemsProcessed(state.iterations());
+	state.SetLabel(EngineName(engine));
+}
+BENCHMARK(BM_ClientChurn)->DenseRange(0, 2)->UseRealTime();
+
+// Four producers feeding one splitter with 4 clients, PutOrder::Any (0) against Sequenced (1).
+static void BM_MultiProducerPut(benchmark::State& state)
+{
+	static ISplitterPtr splitter;
+	static std::unique_ptr<Consumers> consumers;
+
+	const auto engine = static_cast<ISplitter::Engine>(state.range(0));
+	const auto putOrder = static_cast<ISplitter::PutOrder>(state.range(1));
+
+	if (state.thread_index() == 0) {
+		splitter = ISplitter::Create(16, 4, engine, 0, putOrder);
+		consumers = std::make_unique<Consumers>(splitter, AddClients(splitter, 4));
+	}
+
+	auto frame = MakeFrame(64);
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(splitter->Put(frame, -1));
+	}
+
+	if (state.thread_index() == 0) {
+		consumers.reset();
+		splitter.reset();
+	}
+
+	state.SetItemsProcessed(state.iterations());
+	state.SetLabel(std::string(EngineName(engine)) + (putOrder == ISplitter::PutOrder::Sequenced ? "/Sequenced" : "/Any"));
+}
+BENCHMARK(BM_MultiProducerPut)->ArgsProduct({ { 0, 1, 2 }, { 0, 1 } })->Threads(4)->UseRealTime();
+
+// 32 clients that drop their oldest frame when full: every Put writes each client's producer
+// state (dropped count, queue tail) while 32 consumer threads write their own. Shows the cost
+// of the two sides sharing cache lines; compare across builds, ideally on a multi-socket machine.
+static void BM_ClientStateSharing(benchmark::State& state)
+{
+	const auto engine = static_cast<ISplitter::Engine>(state.range(0));
+	const size_t clientCount = 32;
+
+	auto splitter = ISplitter::Create(4, clientCount, engine);
+
+	ISplitter::ClientOptions options;
+	options.policy = ISplitter::OverflowPolicy::DropOldest;
+
+	ClientIds ids;
+	for (size_t i = 0; i < clientCount; i++) {
+		uint32_t id;
+		if (splitter->ClientAdd(&id, options))
+			ids.push_back(id);
+	}
+	Consumers consumers(splitter, ids);
+
+	auto frame = MakeFrame(64);
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(splitter->Put(frame, 0));
+	}
+
+	consumers.Stop();
+
+	size_t totalDropped = 0;
+	for (auto id : ids) {
+		size_t latency;
+		size_t dropped;
+		if (splitter->ClientGetById(id, &latency, &dropped))
+			totalDropped += dropped;
+	}
+
+	state.SetItemsProcessed(state.iterations());
+	state.counters["received"] = static_cast<double>(consumers.Received());
+	state.counters["dropped"] = static_cast<double>(totalDropped);
+	state.SetLabel(EngineName(engine));
+}
+BENCHMARK(BM_ClientStateSharing)->DenseRange(0, 2)->UseRealTime();
+
+// 4 clients that all need the same conversion of a 1 MB frame: each converting after Get (0)
+// or through one shared transform stage that runs on the executor while Put goes on (1).
+static void BM_TransformStage(benchmark::State& state)
+{
+	const bool shared = state.range(0) != 0;
+	const size_t clientCount = 4;
+
+	auto convert = [](const Frame& frame) {
+		auto result = std::make_shared<DataArray>(frame.data->size());
+		for (size_t i = 0; i < result->size(); i++)
+			(*result)[i] = static_cast<uint8_t>((*frame.data)[i] ^ 0x5a);
+		return result;
+	};
+
+	auto splitter = ISplitter::Create(4, clientCount);
+	splitter->SetExecutor(Executor::Create(2));
+
+	ISplitter::ClientOptions options;
+	if (shared)
+		options.transform = std::make_shared<const FrameTransform>(convert);
+
+	std::vector<ISplitter::ClientHandle> clients;
+	for (size_t i = 0; i < clientCount; i++)
+		clients.push_back(splitter->ClientAdd(options));
+
+	auto frame = MakeFrame(1 << 20);
+	for (auto _ : state) {
+		splitter->Put(frame, -1);
+		for (const auto& client : clients) {
+			Frame received;
+			client.Get(received, -1);
+			if (!shared)
+				received.data = convert(received);
+			benchmark::DoNotOptimize(received.data);
+		}
+	}
+
+	state.SetItemsProcessed(state.iterations());
+	state.SetLabel(shared ? "SharedStage" : "PerClient");
+}
+BENCHMARK(BM_TransformStage)->DenseRange(0, 1)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,160 @@
+#include "BufferPool.h"
+
+using namespace std;
+
+const std::string BufferPool::TAG = "BufferPool: ";
+
+BufferPool::BufferPool(size_t maxBuffers)
+	: mMaxBuffers(maxBuffers)
+{
+}
+
+BufferPool::~BufferPool()
+{
+	for (auto block : mFreeBlocks)
+		::operator delete(block);
+}
+
+BufferPoolPtr BufferPool::Create(size_t maxBuffers)
+{
+	return std::make_shared<BufferPool>(maxBuffers);
+}
+
+BufferPool::BufferPtr BufferPool::Acquire(size_t size)
+{
+	const auto sizeClass = GetFittingSizeClass(size);
+
+	std::unique_ptr<Buffer> buffer;
+	if (sizeClass < SizeClassCount) {
+		scoped_lock lock(mPoolMutex);
+		auto& freeBuffers = mFreeBuffers[sizeClass];
+		if (!freeBuffers.empty()) {
+			buffer = std::move(freeBuffers.back());
+			freeBuffers.pop_back();
+			mFreeCount--;
+		}
+	}
+
+	if (!buffer) {
+		buffer = std::make_unique<Buffer>();
+		if (sizeClass < SizeClassCount)
+			buffer->reserve(size_t(1) << sizeClass);
+	}
+
+	buffer->resize(size);
+
+	std::weak_ptr<BufferPool> pool = weak_from_this();
+	return BufferPtr(buffer.release(), Deleter{ pool }, BlockAllocator<Buffer>(pool));
+}
+
+size_t BufferPool::GetMaxCount() const
+{
+	scoped_lock lock(mPoolMutex);
+	return mMaxBuffers;
+}
+
+void BufferPool::SetMaxCount(size_t maxBuffers)
+{
+	std::vector<std::unique_ptr<Buffer>> released;
+	std::vector<void*> releasedBlocks;
+	{
+		scoped_lock lock(mPoolMutex);
+		mMaxBuffers = maxBuffers;
+
+		// The largest buffers go first.
+		for (size_t sizeClass = SizeClassCount; sizeClass > 0 && mFreeCount > mMaxBuffers; sizeClass--) {
+			auto& freeBuffers = mFreeBuffers[sizeClass - 1];
+			while (!freeBuffers.empty() && mFreeCount > mMaxBuffers) {
+				released.push_back(std::move(freeBuffers.back()));
+				freeBuffers.pop_back();
+				mFreeCount--;
+			}
+		}
+
+		while (mFreeBlocks.size() > mMaxBuffers) {
+			releasedBlocks.push_back(mFreeBlocks.back());
+			mFreeBlocks.pop_back();
+		}
+	}
+
+	for (auto block : releasedBlocks)
+		::operator delete(block);
+}
+
+size_t BufferPool::GetFreeCount() const
+{
+	scoped_lock lock(mPoolMutex);
+	return mFreeCount;
+}
+
+// A buffer the pool does not keep is freed after the mutex is released.
+void BufferPool::Release(Buffer* buffer)
+{
+	std::unique_ptr<Buffer> holder(buffer);
+	const auto sizeClass = GetSizeClass(holder->capacity());
+
+	{
+		scoped_lock lock(mPoolMutex);
+		if (mFreeCount < mMaxBuffers) {
+			mFreeBuffers[sizeClass].push_back(std::move(holder));
+			mFreeCount++;
+			return;
+		}
+	}
+
+	holder.reset();
+}
+
+size_t BufferPool::GetSizeClass(size_t capacity)
+{
+	size_t sizeClass = 0;
+	while (capacity >>= 1)
+		sizeClass++;
+
+	return sizeClass;
+}
+
+// SizeClassCount for a size no class fits.
+size_t BufferPool::GetFittingSizeClass(size_t size)
+{
+	const auto sizeClass = GetSizeClass(size);
+	return (size_t(1) << sizeClass) < size ? sizeClass + 1 : sizeClass;
+}
+
+void* BufferPool::AllocateBlock(size_t size)
+{
+	{
+		scoped_lock lock(mPoolMutex);
+		if (size == mBlockSize && !mFreeBlocks.empty()) {
+			auto block = mFreeBlocks.back();
+			mFreeBlocks.pop_back();
+			return block;
+		}
+	}
+
+	return ::operator new(size);
+}
+
+void BufferPool::DeallocateBlock(void* block, size_t size)
+{
+	{
+		scoped_lock lock(mPoolMutex);
+		if (!mBlockSize)
+			mBlockSize = size;
+
+		if (size == mBlockSize && mFreeBlocks.size() < mMaxBuffers) {
+			mFreeBlocks.push_back(block);
+			return;
+		}
+	}
+
+	::operator delete(block);
+}
+
+void BufferPool::Deleter::operator()(Buffer* buffer) const
+{
+	if (auto p = pool.lock())
+		p->Release(buffer);
+	else
+		delete buffer;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <string>
+#include <cstdint>
+
+class BufferPool;
+
+using BufferPoolPtr = std::shared_ptr<BufferPool>;
+
+// Recycles frame buffers handed out as std::shared_ptr<std::vector<uint8_t>>.
+// When the last owner drops a buffer, it goes back to the pool instead of being freed;
+// the shared_ptr control blocks are recycled the same way. Buffers returned after the
+// pool is destroyed, or while the pool already keeps maxBuffers free ones, are freed.
+// Free buffers are kept by power of two size class, so a frame never gets a buffer much
+// larger than it needs, nor one that has to grow.
+class BufferPool : public std::enable_shared_from_this<BufferPool>
+{
+public:
+	using Buffer = std::vector<uint8_t>;
+	using BufferPtr = std::shared_ptr<Buffer>;
+
+public:
+	explicit BufferPool(size_t maxBuffers);
+	~BufferPool();
+
+	static BufferPoolPtr Create(size_t maxBuffers);
+
+	// Returns a buffer of the requested size, with the capacity of its size class.
+	// The content of a recycled buffer is not cleared.
+	BufferPtr Acquire(size_t size);
+
+	size_t GetMaxCount() const;
+	// Changes how many free buffers the pool keeps, extra free ones are released.
+	void SetMaxCount(size_t maxBuffers);
+	size_t GetFreeCount() const;
+
+private:
+	BufferPool(const BufferPool& other) = delete;
+	BufferPool& operator=(const BufferPool& other) = delete;
+
+	void Release(Buffer* buffer);
+
+	// Class k holds buffers with a capacity of at least 2^k: Acquire takes from the smallest
+	// class that fits the size, Release files a buffer under the largest class it covers.
+	static constexpr size_t SizeClassCount = sizeof(size_t) * 8;
+	static size_t GetSizeClass(size_t capacity);
+	static size_t GetFittingSizeClass(size_t size);
+
+	void* AllocateBlock(size_t size);
+	void DeallocateBlock(void* block, size_t size);
+
+	struct Deleter {
+		std::weak_ptr<BufferPool> pool;
+		void operator()(Buffer* buffer) const;
+	};
+
+	template <typename T>
+	struct BlockAllocator {
+		using value_type = T;
+
+		std::weak_ptr<BufferPool> pool;
+
+		explicit BlockAllocator(std::weak_ptr<BufferPool> pool) : pool(std::move(pool)) {}
+		template <typename U>
+		BlockAllocator(const BlockAllocator<U>& other) : pool(other.pool) {}
+
+		T* allocate(size_t n);
+		void deallocate(T* p, size_t n);
+
+		template <typename U>
+		bool operator==(const BlockAllocator<U>& other) const { return !pool.owner_before(other.pool) && !other.pool.owner_before(pool); }
+		template <typename U>
+		bool operator!=(const BlockAllocator<U>& other) const { return !(*this == other); }
+	};
+
+private:
+	mutable std::mutex mPoolMutex;
+	size_t mMaxBuffers;
+	std::array<std::vector<std::unique_ptr<Buffer>>, SizeClassCount> mFreeBuffers;
+	size_t mFreeCount = 0;
+	std::vector<void*> mFreeBlocks;
+	size_t mBlockSize = 0;
+
+	static const std::string TAG;
+};
+
+template <typename T>
+T* BufferPool::BlockAllocator<T>::allocate(size_t n)
+{
+	if (auto p = pool.lock())
+		return static_cast<T*>(p->AllocateBlock(n * sizeof(T)));
+
+	return static_cast<T*>(::operator new(n * sizeof(T)));
+}
+
+template <typename T>
+void BufferPool::BlockAllocator<T>::deallocate(T* ptr, size_t n)
+{
+	if (auto p = pool.lock())
+		p->DeallocateBlock(ptr, n * sizeof(T));
+	else
+		::operator delete(ptr);
+}
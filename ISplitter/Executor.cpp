@@ -0,0 +1,72 @@
+#include "Executor.h"
+
+#include <algorithm>
+
+using namespace std;
+
+const std::string Executor::TAG = "Executor: ";
+
+Executor::Executor(size_t threadCount)
+	: mState(std::make_shared<State>())
+{
+	if (!threadCount)
+		threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+	mThreads.reserve(threadCount);
+	for (size_t i = 0; i < threadCount; i++)
+		mThreads.emplace_back(&Executor::Run, mState);
+}
+
+Executor::~Executor()
+{
+	{
+		scoped_lock lock(mState->taskMutex);
+		mState->stopping = true;
+	}
+	mState->taskCondition.notify_all();
+
+	// A task may drop the last reference to the executor, its own thread cannot be joined.
+	for (auto& thread : mThreads) {
+		if (thread.get_id() == this_thread::get_id())
+			thread.detach();
+		else
+			thread.join();
+	}
+}
+
+ExecutorPtr Executor::Create(size_t threadCount)
+{
+	return std::make_shared<Executor>(threadCount);
+}
+
+void Executor::Post(Task task)
+{
+	{
+		scoped_lock lock(mState->taskMutex);
+		mState->tasks.push_back(std::move(task));
+	}
+	mState->taskCondition.notify_one();
+}
+
+size_t Executor::GetThreadCount() const
+{
+	return mThreads.size();
+}
+
+void Executor::Run(std::shared_ptr<State> state)
+{
+	unique_lock lock(state->taskMutex);
+	for (;;) {
+		state->taskCondition.wait(lock, [&state] { return state->stopping || !state->tasks.empty(); });
+		if (state->tasks.empty())
+			return;
+
+		auto task = std::move(state->tasks.front());
+		state->tasks.pop_front();
+
+		lock.unlock();
+		task();
+		task = nullptr;
+		lock.lock();
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <string>
+
+class Executor;
+
+using ExecutorPtr = std::shared_ptr<Executor>;
+
+// Fixed pool of threads running posted tasks in post order. The destructor runs the tasks
+// still queued (including ones they post) before the threads exit.
+class Executor
+{
+public:
+	using Task = std::function<void()>;
+
+public:
+	// threadCount: 0 - one thread per hardware thread.
+	explicit Executor(size_t threadCount);
+	~Executor();
+
+	static ExecutorPtr Create(size_t threadCount = 0);
+
+	void Post(Task task);
+
+	size_t GetThreadCount() const;
+
+private:
+	Executor(const Executor& other) = delete;
+	Executor& operator=(const Executor& other) = delete;
+
+	// Shared with the threads, so that a thread left running by the destructor still has it.
+	struct State {
+		std::mutex taskMutex;
+		std::condition_variable taskCondition;
+		std::deque<Task> tasks;
+		bool stopping = false;
+	};
+
+	static void Run(std::shared_ptr<State> state);
+
+private:
+	const std::shared_ptr<State> mState;
+	std::vector<std::thread> mThreads;
+
+	static const std::string TAG;
+};
@@ -1,19 +1,40 @@
 #include "ISplitter.h"
+#include "SpillFile.h"
 #include "threadsafe_queue.h"
 
 #include <cassert>
 #include <algorithm>
 #include <iomanip>
+#include <chrono>
+#include <future>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
 const std::string ISplitter::TAG = "ISplitter: ";
 
-ISplitter::ISplitter(size_t maxBuffers, size_t maxClients)
+ISplitter::ISplitter(size_t maxBuffers, size_t maxClients, Engine engine, size_t maxBytes, PutOrder putOrder)
 	: mMaxBuffers(maxBuffers)
-	, mMaxClients(maxClients)
+	, mMaxClients(std::min<size_t>(maxClients, MaxClients))
+	, mEngine(engine)
+	, mPutOrder(putOrder)
+	, mClientSlots(mMaxClients)
 {
+	if (mEngine == Engine::Ring)
+		mRing = std::make_shared<Ring>(mMaxBuffers);
+
+	mBufferPool = BufferPool::Create(GetBufferPoolSize());
 
+	if (maxBytes)
+		mByteBudget = std::make_shared<byte_budget>(maxBytes);
+
+	for (size_t slot = mClientSlots.size(); slot > 0; slot--)
+		mFreeSlots.push_back(static_cast<uint32_t>(slot - 1));
 }
 
 ISplitter::~ISplitter()
@@ -36,6 +57,7 @@ std::string ISplitter::GetErrorText(int32_t errorId)
 	case Error::NoNewData: return "No new data received.";
 	case Error::NoClientFound: return "The client with this ID not found .";
 	case Error::NoClients: return "Clients list empty.";
+	case Error::FrameTooLarge: return "The frame does not fit into a buffer.";
 		
 	default:
 		assert(0);
@@ -44,9 +66,9 @@ std::string ISplitter::GetErrorText(int32_t errorId)
 	return std::string();
 }
 
-std::shared_ptr<ISplitter> ISplitter::Create(size_t maxBuffers, size_t maxClients)
+std::shared_ptr<ISplitter> ISplitter::Create(size_t maxBuffers, size_t maxClients, Engine engine, size_t maxBytes, PutOrder putOrder)
 {
-	return std::make_shared<ISplitter>(maxBuffers, maxClients);
+	return std::make_shared<ISplitter>(maxBuffers, maxClients, engine, maxBytes, putOrder);
 }
 
 bool ISplitter::InfoGet(size_t* pMaxBuffers, size_t* pMaxClients) const
@@ -60,38 +82,202 @@ bool ISplitter::InfoGet(size_t* pMaxBuffers, size_t* pMaxClients) const
 	return true;
 }
 
-bool ISplitter::ClientAdd(uint32_t* pClientID)
+bool ISplitter::InfoGetBytes(size_t* pMaxBytes, size_t* pRetainedBytes) const
+{
+	if (!pMaxBytes || !pRetainedBytes)
+		return false;
+
+	if (mByteBudget) {
+		*pMaxBytes = mByteBudget->max_bytes();
+		*pRetainedBytes = mByteBudget->bytes();
+		return true;
+	}
+
+	// Without a budget the frames are not tracked across clients, add up the ring or the queues.
+	*pMaxBytes = 0;
+	*pRetainedBytes = 0;
+
+	for (const auto& client : *GetClientList()) {
+		*pRetainedBytes = mRing ? std::max(*pRetainedBytes, client->GetRetainedBytes()) : *pRetainedBytes + client->GetRetainedBytes();
+	}
+
+	return true;
+}
+
+DataPtr ISplitter::AcquireBuffer(size_t size)
+{
+	return mBufferPool->Acquire(size);
+}
+
+bool ISplitter::ClientAdd(uint32_t* pClientID, OverflowPolicy policy)
+{
+	ClientOptions options;
+	options.policy = policy;
+
+	return ClientAdd(pClientID, options);
+}
+
+ISplitter::ClientHandle ISplitter::ClientAdd(OverflowPolicy policy)
+{
+	ClientOptions options;
+	options.policy = policy;
+
+	return ClientAdd(options);
+}
+
+bool ISplitter::ClientAdd(uint32_t* pClientID, const ClientOptions& options)
 {
 	if (!pClientID)
 		return false;
 
-	unique_lock lock(mDataClientListMutex);
-	if (mDataClientList.size() == mMaxClients)
+	auto client = ClientAddImpl(options);
+	if (!client)
 		return false;
 
+	*pClientID = client->GetClientId();
+
+	return true;
+}
+
+ISplitter::ClientHandle ISplitter::ClientAdd(const ClientOptions& options)
+{
+	return ClientHandle(ClientAddImpl(options));
+}
+
+ISplitter::DataClientPtr ISplitter::ClientAddImpl(const ClientOptions& options)
+{
+	if (options.group)
+		return GroupMemberAdd(options);
+
+	const bool spills = options.policy == OverflowPolicy::Spill;
+	if (spills && mRing)
+		return DataClientPtr();
+
+	unique_lock lock(mClientListMutex);
+	if (GetClientList()->size() == mMaxClients || mFreeSlots.empty())
+		return DataClientPtr();
+
+	const uint32_t clientId = TakeClientSlot();
+	auto& clientSlot = mClientSlots[clientId & ClientSlotMask];
+
 	lock.unlock();
+
+	// The spill file is only created once the client has a slot; a client that cannot spill
+	// gives the slot back.
+	SpillFilePtr spill;
+	if (spills) {
+		spill = SpillFile::Create(options.spillPath, options.spillBytes);
+		if (!spill) {
+			lock.lock();
+			mFreeSlots.push_back(clientId & ClientSlotMask);
+			return DataClientPtr();
+		}
+	}
 	
-	auto client = DataClient::Create(mMaxBuffers);
-	*pClientID = client->GetClientId();
+	ClientOptions clientOptions = options;
+	if (!clientOptions.maxBuffers || (mRing && clientOptions.maxBuffers > mMaxBuffers))
+		clientOptions.maxBuffers = mMaxBuffers;
+
+	auto client = mRing ? DataClient::Create(clientId, mRing, clientOptions) : DataClient::Create(clientId, mEngine, clientOptions, spill);
 
 	lock.lock();
-	mDataClientList.push_back(std::move(client));
+	std::atomic_store(&clientSlot.client, client);
 
-	return true;
+	// The list stays sorted by priority, Put walks it from the front.
+	auto clients = std::make_shared<DataClientList>(*GetClientList());
+	auto position = std::find_if(begin(*clients), end(*clients),
+		[&client](const DataClientPtr& other) { return other->GetPriority() < client->GetPriority(); });
+	clients->insert(position, client);
+	SetClientList(std::move(clients));
+
+	// Put takes its sequence before it loads the list. Every sequence from here on is taken
+	// by a Put that sees the client; earlier ones may see it too and have to pass it by.
+	atomic_thread_fence(memory_order_seq_cst);
+	client->SetFirstSequence(mNextSequence.load(memory_order_seq_cst));
+
+	mBufferPool->SetMaxCount(GetBufferPoolSize());
+
+	return client;
+}
+
+// A member only takes a client slot and joins its group client, Put never sees it.
+ISplitter::DataClientPtr ISplitter::GroupMemberAdd(const ClientOptions& options)
+{
+	scoped_lock lock(mClientListMutex);
+
+	// Joining through a member joins its group.
+	auto group = FindClient(options.group);
+	if (group && group->GetGroup())
+		group = group->GetGroup();
+
+	if (!group || mFreeSlots.empty())
+		return DataClientPtr();
+
+	const uint32_t clientId = TakeClientSlot();
+	auto client = DataClient::Create(clientId, group, options);
+
+	std::atomic_store(&mClientSlots[clientId & ClientSlotMask].client, client);
+	group->AddMember(client);
+
+	return client;
+}
+
+// Takes a free slot under the client list mutex and returns the ID of its next generation.
+uint32_t ISplitter::TakeClientSlot()
+{
+	const auto slot = mFreeSlots.back();
+	mFreeSlots.pop_back();
+
+	auto& clientSlot = mClientSlots[slot];
+	if (++clientSlot.generation > ClientGenerationMax)
+		clientSlot.generation = 1;
+
+	return (clientSlot.generation << ClientSlotBits) | slot;
+}
+
+// Frees the client's slot and disconnects it, with its group members. Under the client list mutex;
+// the caller ends their subscriptions once it has let go of the mutex, as callbacks may call back in.
+void ISplitter::ReleaseClient(const DataClientPtr& client, std::vector<DataClientPtr>& released)
+{
+	const auto slot = client->GetClientId() & ClientSlotMask;
+	std::atomic_store(&mClientSlots[slot].client, DataClientPtr());
+	mFreeSlots.push_back(slot);
+
+	client->Disconnect();
+	released.push_back(client);
+
+	for (const auto& member : client->TakeMembers())
+		ReleaseClient(member, released);
 }
 
 bool ISplitter::ClientRemove(uint32_t clientID)
 {
-	unique_lock lock(mDataClientListMutex);
-	for (auto it = begin(mDataClientList); it != end(mDataClientList); ++it) {
-		if ( (*it)->GetClientId() == clientID) {
-			(*it)->FlushData();
-			mDataClientList.erase(it);
-			return true;
+	std::vector<DataClientPtr> released;
+	{
+		unique_lock lock(mClientListMutex);
+		auto client = FindClient(clientID);
+		if (!client)
+			return false;
+
+		if (const auto& group = client->GetGroup()) {
+			group->RemoveMember(client);
+		}
+		else {
+			// A Put still walking the old list keeps the client alive until it is done with it.
+			auto clients = std::make_shared<DataClientList>(*GetClientList());
+			clients->erase(std::find(begin(*clients), end(*clients), client));
+			SetClientList(std::move(clients));
+
+			mBufferPool->SetMaxCount(GetBufferPoolSize());
 		}
-	}	
 
-	return false;
+		ReleaseClient(client, released);
+	}
+
+	for (const auto& client : released)
+		client->EndSubscription();
+
+	return true;
 }
 
 bool ISplitter::ClientGetCount(size_t* pCount) const
@@ -106,17 +292,19 @@ bool ISplitter::ClientGetCount(size_t* pCount) const
 
 size_t ISplitter::GetClientCountImpl() const
 {
-	shared_lock lock(mDataClientListMutex);
-	return  mDataClientList.size();
+	return GetClientList()->size();
 }
 
 bool ISplitter::ClientGetByIndex(size_t index, uint32_t* pClientID, size_t* pLatency, size_t* pDropped) const
 {
-	if (!pLatency || !pDropped || !pClientID || index >= GetClientCountImpl())
-		return false;		
+	if (!pLatency || !pDropped || !pClientID)
+		return false;
 
-	shared_lock lock(mDataClientListMutex);
-	const auto & client = mDataClientList[index];
+	auto clients = GetClientList();
+	if (index >= clients->size())
+		return false;
+
+	const auto & client = (*clients)[index];
 
 	*pClientID = client->GetClientId();
 	*pLatency = client->GetLatencyCount();
@@ -133,32 +321,124 @@ bool ISplitter::ClientGetById(uint32_t clientID, size_t* pLatency, size_t* pDrop
 	*pLatency = 0;
 	*pDropped = 0;
 
-	shared_lock lock(mDataClientListMutex);
-	for (auto it = begin(mDataClientList); it != end(mDataClientList); ++it) {
-		if ((*it)->GetClientId() == clientID) {
-			
-			*pLatency = (*it)->GetLatencyCount();
-			*pDropped = (*it)->GetDroppedCount();
+	auto client = FindClient(clientID);
+	if (!client)
+		return false;
 
-			return true;
-		}
-	}
+	*pLatency = client->GetLatencyCount();
+	*pDropped = client->GetDroppedCount();
+
+	return true;
+}
+
+bool ISplitter::ClientGetStats(uint32_t clientID, ClientStats* pStats) const
+{
+	if (!pStats)
+		return false;
+
+	*pStats = ClientStats();
+
+	auto client = FindClient(clientID);
+	if (!client)
+		return false;
 
-	return false;
+	client->GetStats(pStats);
+
+	return true;
 }
 
 int32_t ISplitter::Put(const DataPtr& data, int32_t nWaitForBuffersFreeTimeOutMsec)
+{
+	return Put(data, FrameTagsPtr(), nWaitForBuffersFreeTimeOutMsec);
+}
+
+int32_t ISplitter::Put(const DataPtr& data, FrameTagsPtr tags, int32_t nWaitForBuffersFreeTimeOutMsec)
+{
+	chrono::steady_clock::time_point deadline;
+	return PutImpl(data, std::move(tags), ToDeadline(nWaitForBuffersFreeTimeOutMsec, deadline));
+}
+
+int32_t ISplitter::PutUntil(const DataPtr& data, const chrono::steady_clock::time_point& deadline)
+{
+	return PutImpl(data, FrameTagsPtr(), &deadline);
+}
+
+int32_t ISplitter::PutUntil(const DataPtr& data, FrameTagsPtr tags, const chrono::steady_clock::time_point& deadline)
+{
+	return PutImpl(data, std::move(tags), &deadline);
+}
+
+// pDeadline: nullptr - wait for the full clients without a timeout.
+int32_t ISplitter::PutImpl(const DataPtr& data, FrameTagsPtr tags, const chrono::steady_clock::time_point* pDeadline)
 {
 	int32_t error = 0;	
 
-	shared_lock lock(mDataClientListMutex);
+	QueuedData item;
+	item.data = data;
+	item.putTime = chrono::steady_clock::now();
+	item.tags = std::move(tags);
+	item.flushEpoch = mFlushEpoch.load(memory_order_seq_cst);
+
+	// A frame the byte budget drops still takes its sequence number, so clients see the gap.
+	// The sequence is taken before the client list is loaded, see ClientAddImpl.
+	const bool sequenced = mPutOrder == PutOrder::Sequenced;
+	item.sequence = mNextSequence.fetch_add(1, memory_order_seq_cst);
+
+	const auto clients = GetClientList();
+	if (clients->empty()) {
+		if (sequenced)
+			SkipSequences(*clients, item.sequence, item.sequence);
 
-	if (!mDataClientList.size())
 		return static_cast<int32_t>(Error::NoClients);
+	}
+
+	if (mByteBudget && !RetainBytes(item, pDeadline)) {
+		for (const auto& client : *clients)
+			client->AddDropped(1);
+
+		if (sequenced)
+			SkipSequences(*clients, item.sequence, item.sequence);
+
+		return static_cast<int32_t>(Error::DataDropped);
+	}
+
+	StartTransforms(*clients, &item, 1);
+
+	if (mRing) {
+		if (sequenced) mRingPutTurn.wait(item.sequence);
+		const auto dropped = mRing->push_batch(&item, 1, pDeadline);
+		if (sequenced) mRingPutTurn.pass(item.sequence);
 
-	for (auto it = begin(mDataClientList); it != end(mDataClientList); ++it) {
-		auto err = (*it)->PutData(data, nWaitForBuffersFreeTimeOutMsec);
+		for (const auto& client : *clients)
+			client->NotifyWaiters();
+
+		return dropped ? static_cast<int32_t>(Error::DataDropped) : error;
+	}
+
+	// Clients with a free buffer get the frame right away. Full clients are waited on
+	// afterwards against one shared deadline, so Put never blocks longer than a single
+	// timeout no matter how many clients lag.
+	// A sequenced Put keeps the turn of a full client until the second pass has delivered to it.
+	std::vector<DataClient*> fullClients;
+	for (auto it = begin(*clients); it != end(*clients); ++it) {
+		if (sequenced) {
+			if (!(*it)->TakesSequence(item.sequence))
+				continue;
+
+			(*it)->WaitPutTurn(item.sequence);
+		}
+
+		if (!(*it)->TryPutData(item))
+			fullClients.push_back(it->get());
+		else if (sequenced)
+			(*it)->PassPutTurn(item.sequence);
+	}
+
+	for (auto client : fullClients) {
+		auto err = pDeadline ? client->PutDataUntil(item, *pDeadline) : client->PutData(item, -1);
 		if (err) error = err;
+
+		if (sequenced) client->PassPutTurn(item.sequence);
 	}
 
 	return error;
@@ -166,22 +446,227 @@ int32_t ISplitter::Put(const DataPtr& data, int32_t nWaitForBuffersFreeTimeOutMs
 
 int32_t ISplitter::Get(uint32_t nClientID, DataPtr& data, int32_t nWaitForNewDataTimeOutMsec)
 {
-	shared_lock lock(mDataClientListMutex);
-	for (auto it = begin(mDataClientList); it != end(mDataClientList); ++it) {
-		if ((*it)->GetClientId() == nClientID) {			
-			int32_t error = (*it)->GetData(data, nWaitForNewDataTimeOutMsec);
-			return error;
+	auto client = FindClient(nClientID);
+	if (!client)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	chrono::steady_clock::time_point deadline;
+	return client->GetData(data, ToDeadline(nWaitForNewDataTimeOutMsec, deadline));
+}
+
+int32_t ISplitter::Get(uint32_t nClientID, Frame& frame, int32_t nWaitForNewDataTimeOutMsec)
+{
+	auto client = FindClient(nClientID);
+	if (!client)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	chrono::steady_clock::time_point deadline;
+	return client->GetData(frame, ToDeadline(nWaitForNewDataTimeOutMsec, deadline));
+}
+
+int32_t ISplitter::GetUntil(uint32_t nClientID, DataPtr& data, const chrono::steady_clock::time_point& deadline)
+{
+	auto client = FindClient(nClientID);
+	if (!client)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	return client->GetData(data, &deadline);
+}
+
+int32_t ISplitter::GetUntil(uint32_t nClientID, Frame& frame, const chrono::steady_clock::time_point& deadline)
+{
+	auto client = FindClient(nClientID);
+	if (!client)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	return client->GetData(frame, &deadline);
+}
+
+int32_t ISplitter::TryGet(uint32_t nClientID, DataPtr& data)
+{
+	auto client = FindClient(nClientID);
+	if (!client)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	return client->TryGetData(data);
+}
+
+int32_t ISplitter::TryGet(uint32_t nClientID, Frame& frame)
+{
+	auto client = FindClient(nClientID);
+	if (!client)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	return client->TryGetData(frame);
+}
+
+int32_t ISplitter::Get(uint32_t nClientID, FrameView& view, int32_t nWaitForNewDataTimeOutMsec)
+{
+	auto client = FindClient(nClientID);
+	if (!client)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	chrono::steady_clock::time_point deadline;
+	return client->GetData(view, ToDeadline(nWaitForNewDataTimeOutMsec, deadline));
+}
+
+int32_t ISplitter::TryGet(uint32_t nClientID, FrameView& view)
+{
+	auto client = FindClient(nClientID);
+	if (!client)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	return client->TryGetData(view);
+}
+
+int ISplitter::ClientGetEventFd(uint32_t clientID)
+{
+	auto client = FindClient(clientID);
+	if (!client)
+		return -1;
+
+	return client->GetEventFd();
+}
+
+int32_t ISplitter::PutBatch(const DataPtrList& dataList, int32_t nWaitForBuffersFreeTimeOutMsec, size_t* pDropped)
+{
+	if (pDropped)
+		*pDropped = 0;
+
+	if (dataList.empty())
+		return GetClientList()->empty() ? static_cast<int32_t>(Error::NoClients) : 0;
+
+	// The batch takes consecutive sequence numbers, frames the byte budget drops included,
+	// and one turn per client.
+	const bool sequenced = mPutOrder == PutOrder::Sequenced;
+	const auto firstSequence = mNextSequence.fetch_add(dataList.size(), memory_order_seq_cst);
+	const auto lastSequence = firstSequence + dataList.size() - 1;
+
+	const auto clients = GetClientList();
+	if (clients->empty()) {
+		if (sequenced)
+			SkipSequences(*clients, firstSequence, lastSequence);
+
+		return static_cast<int32_t>(Error::NoClients);
+	}
+
+	const auto putTime = chrono::steady_clock::now();
+	chrono::steady_clock::time_point deadline;
+	const auto* pDeadline = ToDeadline(nWaitForBuffersFreeTimeOutMsec, deadline);
+
+	size_t dropped = 0;
+
+	const auto flushEpoch = mFlushEpoch.load(memory_order_seq_cst);
+
+	QueuedDataList items;
+	items.reserve(dataList.size());
+	for (size_t i = 0; i < dataList.size(); i++) {
+		QueuedData item;
+		item.data = dataList[i];
+		item.putTime = putTime;
+		item.sequence = firstSequence + i;
+		item.flushEpoch = flushEpoch;
+
+		if (mByteBudget && !RetainBytes(item, pDeadline)) {
+			for (const auto& client : *clients)
+				client->AddDropped(1);
+
+			dropped += clients->size();
+			continue;
+		}
+
+		items.push_back(std::move(item));
+	}
+
+	if (items.empty()) {
+		if (sequenced)
+			SkipSequences(*clients, firstSequence, lastSequence);
+
+		if (pDropped)
+			*pDropped = dropped;
+
+		return static_cast<int32_t>(Error::DataDropped);
+	}
+
+	StartTransforms(*clients, items.data(), items.size());
+
+	if (mRing) {
+		if (sequenced) mRingPutTurn.wait(firstSequence);
+		dropped += mRing->push_batch(items.data(), items.size(), pDeadline);
+		if (sequenced) mRingPutTurn.pass(lastSequence);
+
+		for (const auto& client : *clients)
+			client->NotifyWaiters();
+	}
+	else {
+		// Same two passes as Put: fill free buffers first, then wait for the rest against one deadline.
+		std::vector<std::pair<DataClient*, size_t>> fullClients;
+		for (auto it = begin(*clients); it != end(*clients); ++it) {
+			if (sequenced) {
+				if (!(*it)->TakesSequence(firstSequence))
+					continue;
+
+				(*it)->WaitPutTurn(firstSequence);
+			}
+
+			auto pushed = (*it)->TryPutDataBatch(items.data(), items.size());
+			if (pushed < items.size())
+				fullClients.emplace_back(it->get(), pushed);
+			else if (sequenced)
+				(*it)->PassPutTurn(lastSequence);
+		}
+
+		for (const auto& [client, pushed] : fullClients) {
+			dropped += client->PutDataBatch(items.data() + pushed, items.size() - pushed, pDeadline);
+
+			if (sequenced) client->PassPutTurn(lastSequence);
 		}
 	}
 
-	return static_cast<int32_t>(Error::NoClientFound);
+	if (pDropped)
+		*pDropped = dropped;
+
+	return dropped ? static_cast<int32_t>(Error::DataDropped) : 0;
+}
+
+int32_t ISplitter::GetBatch(uint32_t nClientID, DataPtrList& dataList, size_t maxCount, int32_t nWaitForNewDataTimeOutMsec)
+{
+	auto client = FindClient(nClientID);
+	if (!client)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	chrono::steady_clock::time_point deadline;
+	return client->GetDataBatch(dataList, maxCount, ToDeadline(nWaitForNewDataTimeOutMsec, deadline));
+}
+
+int32_t ISplitter::GetBatch(uint32_t nClientID, FrameList& frameList, size_t maxCount, int32_t nWaitForNewDataTimeOutMsec)
+{
+	auto client = FindClient(nClientID);
+	if (!client)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	chrono::steady_clock::time_point deadline;
+	return client->GetDataBatch(frameList, maxCount, ToDeadline(nWaitForNewDataTimeOutMsec, deadline));
 }
 
+int32_t ISplitter::GetBatch(uint32_t nClientID, FrameViewList& viewList, size_t maxCount, int32_t nWaitForNewDataTimeOutMsec)
+{
+	auto client = FindClient(nClientID);
+	if (!client)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	chrono::steady_clock::time_point deadline;
+	return client->GetDataBatch(viewList, maxCount, ToDeadline(nWaitForNewDataTimeOutMsec, deadline));
+}
+
+// Takes no splitter lock and allocates nothing: each client drops what it has queued and
+// pending Gets return. Frames a concurrent Put stamped with the old epoch and queued after
+// that are discarded by the client when it gets to them.
 int32_t ISplitter::Flush()
 {
-	unique_lock lock(mDataClientListMutex);
-	for (auto it = begin(mDataClientList); it != end(mDataClientList); ++it) {		
-		(*it)->FlushData();			
+	const auto flushEpoch = mFlushEpoch.fetch_add(1, memory_order_seq_cst) + 1;
+	for (const auto& client : *GetClientList()) {
+		client->FlushData(flushEpoch);
 	}
 
 	return static_cast<int>(Error::DataFlushed);
@@ -191,88 +676,1264 @@ int32_t ISplitter::Close()
 {
 	auto errorId = Flush();
 
-	unique_lock lock(mDataClientListMutex);
-	mDataClientList.clear();
+	std::vector<DataClientPtr> released;
+	{
+		unique_lock lock(mClientListMutex);
+		auto clients = GetClientList();
+		SetClientList(std::make_shared<DataClientList>());
+
+		for (const auto& client : *clients)
+			ReleaseClient(client, released);
+
+		mBufferPool->SetMaxCount(GetBufferPoolSize());
+	}
+
+	for (const auto& client : released)
+		client->EndSubscription();
 
 	return errorId;
 }
 
+// Upper bound of frames alive at once: every client can keep its queued frames plus the one
+// it is processing, and the producer fills one more. Free client slots count with maxBuffers.
+// Saturates at SIZE_MAX; the pool only keeps as many free buffers as frames came back.
+size_t ISplitter::GetBufferPoolSize() const
+{
+	auto add = [](size_t a, size_t b) { return a > SIZE_MAX - b ? SIZE_MAX : a + b; };
 
-//////////////////////// DATA CLIENT ///////////////////////////////////////////////////////
+	auto clients = GetClientList();
 
-const std::string ISplitter::DataClient::TAG = "ISplitter::DataClient: ";
+	const size_t freeSlots = mMaxClients - clients->size();
+	const size_t perFreeSlot = add(mMaxBuffers, 1);
+	size_t size = add(freeSlots > SIZE_MAX / perFreeSlot ? SIZE_MAX : freeSlots * perFreeSlot, 1);
+	for (const auto& client : *clients)
+		size = add(size, add(client->GetMaxBuffers(), 1));
 
-ISplitter::DataClient::DataClient(size_t maxBuffers)
-	: mClientId(GenerateId())	
-{	
-	mDataQueue.reset(new Queue(maxBuffers));
+	return size;
 }
 
-ISplitter::DataClient::~DataClient()
+// Snapshot of the clients for readers that take no lock. Writers hold mClientListMutex
+// and swap in a new list; a snapshot and its clients live until the last reader drops it.
+ISplitter::DataClientListPtr ISplitter::GetClientList() const
 {
+	return std::atomic_load(&mClientList);
+}
 
+void ISplitter::SetClientList(DataClientListPtr clients)
+{
+	std::atomic_store(&mClientList, std::move(clients));
 }
 
-ISplitter::DataClientPtr ISplitter::DataClient::Create(size_t maxBuffers)
+const chrono::steady_clock::time_point* ISplitter::ToDeadline(int32_t timeOutMsec, chrono::steady_clock::time_point& deadline)
 {
-	return std::make_shared<DataClient>(maxBuffers);
+	if (timeOutMsec == -1)
+		return nullptr;
+
+	deadline = chrono::steady_clock::now() + chrono::milliseconds(std::max(timeOutMsec, 0));
+	return &deadline;
 }
 
-uint32_t ISplitter::DataClient::GenerateId()
+// Takes the frame's bytes from the splitter byte budget, waiting until the deadline (nullptr - infinite).
+// They go back to the budget when the last copy of the item is destroyed.
+bool ISplitter::RetainBytes(QueuedData& item, const std::chrono::steady_clock::time_point* pDeadline)
 {
-	static uint32_t sId = 0;	
-	return ++sId;
+	const auto bytes = value_bytes(item);
+	if (!mByteBudget->acquire(bytes, pDeadline))
+		return false;
+
+	auto budget = mByteBudget;
+	item.budget = std::shared_ptr<void>(nullptr, [budget, bytes](void*) { budget->release(bytes); });
+
+	return true;
 }
 
-uint32_t ISplitter::DataClient::GetClientId() const
+// Posts the transform stages of the clients to the executor, each stage once per frame however
+// many clients share it. A Get never waits for a stage that has not started: it runs the stage
+// itself, see RunTransform(TransformTask&). Otherwise a Subscribe delivery or GetAsync resumption
+// on the executor could wait for a stage queued behind it.
+// The queued items own the stages, the executor only a weak reference: a stage whose frame every
+// client dropped, or that was flushed, is skipped, so a transform slower than Put runs only for
+// the frames still queued.
+void ISplitter::StartTransforms(const DataClientList& clients, QueuedData* items, size_t count)
 {
-	return mClientId;
+	std::vector<FrameTransformPtr> transforms;
+	for (const auto& client : clients) {
+		const auto& transform = client->GetTransform();
+		if (transform && std::find(begin(transforms), end(transforms), transform) == end(transforms))
+			transforms.push_back(transform);
+	}
+
+	if (transforms.empty())
+		return;
+
+	const auto executor = GetExecutor();
+	for (size_t i = 0; i < count; i++) {
+		auto& item = items[i];
+
+		auto results = std::make_shared<TransformResults>();
+		results->reserve(transforms.size());
+		for (const auto& transform : transforms) {
+			auto task = std::make_shared<TransformTask>();
+			task->transform = transform;
+			task->frame = Frame{ item.data, item.sequence, item.putTime, item.tags };
+			task->result = task->promise.get_future().share();
+			results->push_back(task);
+
+			executor->Post([weakTask = std::weak_ptr<TransformTask>(task)] {
+				if (auto task = weakTask.lock())
+					RunTransform(*task);
+			});
+		}
+
+		item.transformed = std::move(results);
+	}
 }
 
-size_t ISplitter::DataClient::GetDroppedCount() const
+DataPtr ISplitter::RunTransform(const FrameTransform& transform, const Frame& frame)
 {
-	scoped_lock lock(mClientInfoMutex);
-	return mDropped;
+	try {
+		return transform(frame);
+	}
+	catch (...) {
+		return DataPtr();
+	}
 }
 
-size_t ISplitter::DataClient::GetLatencyCount() const
-{	
-	return mDataQueue->size();
+// Runs the stage unless another thread took it first; that one is running it already.
+void ISplitter::RunTransform(TransformTask& task)
+{
+	if (task.claimed.exchange(true, memory_order_acq_rel))
+		return;
+
+	task.promise.set_value(RunTransform(*task.transform, task.frame));
 }
 
-int32_t ISplitter::DataClient::PutData(const DataPtr& data, int32_t nWaitForBuffersFreeTimeOutMsec)
+void ISplitter::SetExecutor(const ExecutorPtr& executor)
 {
-	if (!mDataQueue->push(data, nWaitForBuffersFreeTimeOutMsec)) {
-		{
-			scoped_lock lock(mClientInfoMutex);
-			mDropped++;
-		}
+	scoped_lock lock(mExecutorMutex);
+	mExecutor = executor;
+}
 
-		return static_cast<int32_t>(Error::DataDropped);
-	}
+ExecutorPtr ISplitter::GetExecutor()
+{
+	scoped_lock lock(mExecutorMutex);
+	if (!mExecutor)
+		mExecutor = Executor::Create();
 
-	return 0;
+	return mExecutor;
 }
 
-int32_t ISplitter::DataClient::GetData(DataPtr& data, int32_t nWaitForNewDataTimeOutMsec)
+bool ISplitter::Subscribe(uint32_t clientID, DataCallback callback)
 {
-	if (!mDataQueue->try_pop(data)) {
-		if (!mDataQueue->wait_and_pop(data, nWaitForNewDataTimeOutMsec)) {
-			return static_cast<int32_t>(Error::NoNewData);
-		}
+	auto client = FindClient(clientID);
+	if (!client || !callback || !client->SetSubscribed(std::move(callback)))
+		return false;
+
+	auto executor = GetExecutor();
+	executor->Post([client, executor] { Deliver(client, executor); });
+
+	return true;
+}
+
+// Hands the client's frames to the callback, then leaves a waiter that posts the next
+// delivery. A long backlog is split into several tasks so that other clients get their turn.
+void ISplitter::Deliver(const DataClientPtr& client, const ExecutorPtr& executor)
+{
+	static constexpr size_t MaxFramesPerTask = 64;
+
+	auto error = client->DeliverData(MaxFramesPerTask);
+	if (error == static_cast<int32_t>(Error::NoClientFound))
+		return;
+
+	auto post = [client, executor] {
+		executor->Post([client, executor] { Deliver(client, executor); });
+	};
+
+	if (!error)
+		post();
+	else
+		client->AddWaiter(std::move(post));
+}
+
+#if defined(__cpp_impl_coroutine)
+ISplitter::GetAwaiter ISplitter::GetAsync(uint32_t clientID, DataPtr& data)
+{
+	auto client = FindClient(clientID);
+	return GetAwaiter(client, client ? GetExecutor() : ExecutorPtr(), data);
+}
+#endif
+
+// PutOrder::Sequenced: passes the turns of sequences that no client gets.
+void ISplitter::SkipSequences(const DataClientList& clients, uint64_t firstSequence, uint64_t lastSequence)
+{
+	if (mRing) {
+		mRingPutTurn.wait(firstSequence);
+		mRingPutTurn.pass(lastSequence);
+		return;
 	}
 
-    return 0;
+	for (const auto& client : clients) {
+		if (!client->TakesSequence(firstSequence))
+			continue;
+
+		client->WaitPutTurn(firstSequence);
+		client->PassPutTurn(lastSequence);
+	}
 }
 
-void ISplitter::DataClient::FlushData()
+ISplitter::DataClientPtr ISplitter::FindClient(uint32_t clientID) const
 {
-	auto maxLength = mDataQueue->max_length();
-	mDataQueue->flush();
-	mDataQueue.reset(new Queue(maxLength));
+	const auto slot = clientID & ClientSlotMask;
+	if (slot >= mClientSlots.size())
+		return DataClientPtr();
+
+	auto client = std::atomic_load(&mClientSlots[slot].client);
+	if (!client || client->GetClientId() != clientID)
+		return DataClientPtr();
 
-	scoped_lock lock(mClientInfoMutex);
-	mDropped = 0;
+	return client;
 }
 
 
+#if defined(__cpp_impl_coroutine)
+
+//////////////////////// GET AWAITER /////////////////////////////////////////////////////////
+
+ISplitter::GetAwaiter::GetAwaiter(std::shared_ptr<DataClient> client, ExecutorPtr executor, DataPtr& data)
+	: mClient(std::move(client))
+	, mExecutor(std::move(executor))
+	, mData(data)
+{
+}
+
+bool ISplitter::GetAwaiter::await_ready()
+{
+	if (!mClient) {
+		mError = static_cast<int32_t>(Error::NoClientFound);
+		return true;
+	}
+
+	mError = mClient->TryGetData(mData);
+	return mError != static_cast<int32_t>(Error::NoNewData);
+}
+
+void ISplitter::GetAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+	mHandle = handle;
+	Wait();
+}
+
+int32_t ISplitter::GetAwaiter::await_resume() const
+{
+	return mError;
+}
+
+// The awaiter lives in the suspended coroutine's frame, so the tasks can refer to it.
+// A frame taken by a competing Get only means waiting again.
+void ISplitter::GetAwaiter::Wait()
+{
+	mClient->AddWaiter([this] {
+		mExecutor->Post([this] {
+			mError = mClient->TryGetData(mData);
+			if (mError == static_cast<int32_t>(Error::NoNewData))
+				Wait();
+			else
+				mHandle.resume();
+		});
+	});
+}
+
+#endif
+
+//////////////////////// CLIENT HANDLE ///////////////////////////////////////////////////////
+
+ISplitter::ClientHandle::ClientHandle(std::shared_ptr<DataClient> client)
+	: mClient(std::move(client))
+{
+}
+
+uint32_t ISplitter::ClientHandle::GetClientId() const
+{
+	return mClient ? mClient->GetClientId() : 0;
+}
+
+bool ISplitter::ClientHandle::IsValid() const
+{
+	return mClient && !mClient->IsRemoved();
+}
+
+int32_t ISplitter::ClientHandle::Get(DataPtr& data, int32_t nWaitForNewDataTimeOutMsec) const
+{
+	if (!mClient)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	chrono::steady_clock::time_point deadline;
+	return mClient->GetData(data, ToDeadline(nWaitForNewDataTimeOutMsec, deadline));
+}
+
+int32_t ISplitter::ClientHandle::Get(Frame& frame, int32_t nWaitForNewDataTimeOutMsec) const
+{
+	if (!mClient)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	chrono::steady_clock::time_point deadline;
+	return mClient->GetData(frame, ToDeadline(nWaitForNewDataTimeOutMsec, deadline));
+}
+
+int32_t ISplitter::ClientHandle::GetUntil(DataPtr& data, const chrono::steady_clock::time_point& deadline) const
+{
+	if (!mClient)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	return mClient->GetData(data, &deadline);
+}
+
+int32_t ISplitter::ClientHandle::GetUntil(Frame& frame, const chrono::steady_clock::time_point& deadline) const
+{
+	if (!mClient)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	return mClient->GetData(frame, &deadline);
+}
+
+int32_t ISplitter::ClientHandle::TryGet(DataPtr& data) const
+{
+	if (!mClient)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	return mClient->TryGetData(data);
+}
+
+int32_t ISplitter::ClientHandle::TryGet(Frame& frame) const
+{
+	if (!mClient)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	return mClient->TryGetData(frame);
+}
+
+int32_t ISplitter::ClientHandle::Get(FrameView& view, int32_t nWaitForNewDataTimeOutMsec) const
+{
+	if (!mClient)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	chrono::steady_clock::time_point deadline;
+	return mClient->GetData(view, ToDeadline(nWaitForNewDataTimeOutMsec, deadline));
+}
+
+int32_t ISplitter::ClientHandle::TryGet(FrameView& view) const
+{
+	if (!mClient)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	return mClient->TryGetData(view);
+}
+
+int ISplitter::ClientHandle::GetEventFd() const
+{
+	if (!mClient || mClient->IsRemoved())
+		return -1;
+
+	return mClient->GetEventFd();
+}
+
+int32_t ISplitter::ClientHandle::GetBatch(DataPtrList& dataList, size_t maxCount, int32_t nWaitForNewDataTimeOutMsec) const
+{
+	if (!mClient)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	chrono::steady_clock::time_point deadline;
+	return mClient->GetDataBatch(dataList, maxCount, ToDeadline(nWaitForNewDataTimeOutMsec, deadline));
+}
+
+int32_t ISplitter::ClientHandle::GetBatch(FrameList& frameList, size_t maxCount, int32_t nWaitForNewDataTimeOutMsec) const
+{
+	if (!mClient)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	chrono::steady_clock::time_point deadline;
+	return mClient->GetDataBatch(frameList, maxCount, ToDeadline(nWaitForNewDataTimeOutMsec, deadline));
+}
+
+int32_t ISplitter::ClientHandle::GetBatch(FrameViewList& viewList, size_t maxCount, int32_t nWaitForNewDataTimeOutMsec) const
+{
+	if (!mClient)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	chrono::steady_clock::time_point deadline;
+	return mClient->GetDataBatch(viewList, maxCount, ToDeadline(nWaitForNewDataTimeOutMsec, deadline));
+}
+
+
+//////////////////////// FRAME VIEW ////////////////////////////////////////////////////////
+
+FrameView FrameView::Make(DataPtr data, const FrameSlice& slice)
+{
+	FrameView view;
+	const size_t size = data ? data->size() : 0;
+	view.parent = std::move(data);
+
+	view.offset = std::min(slice.offset, size);
+	view.length = slice.length ? slice.length : size - view.offset;
+	view.stride = slice.stride ? slice.stride : view.length;
+
+	// Rows that would reach past the end of the frame are cut off, so every row is complete.
+	if (view.length && view.length <= size - view.offset) {
+		const size_t fit = 1 + (size - view.offset - view.length) / view.stride;
+		view.rows = slice.rows ? std::min(slice.rows, fit) : fit;
+	}
+
+	return view;
+}
+
+const uint8_t* FrameView::GetRow(size_t index) const
+{
+	if (index >= rows)
+		return nullptr;
+
+	return parent->data() + offset + index * stride;
+}
+
+size_t FrameView::GetSize() const
+{
+	return length * rows;
+}
+
+DataArray FrameView::ToArray() const
+{
+	DataArray array;
+	array.reserve(GetSize());
+	for (size_t row = 0; row < rows; row++) {
+		const auto* begin = GetRow(row);
+		array.insert(array.end(), begin, begin + length);
+	}
+
+	return array;
+}
+
+
+//////////////////////// DATA CLIENT ///////////////////////////////////////////////////////
+
+const std::string ISplitter::DataClient::TAG = "ISplitter::DataClient: ";
+
+ISplitter::DataClient::DataClient(uint32_t clientId, Engine engine, const ClientOptions& options, const SpillFilePtr& spill)
+	: mClientId(clientId)	
+	, mEngine(engine)
+	, mOverflowPolicy(options.policy)
+	, mMaxBuffers(options.maxBuffers)
+	, mMaxBytes(options.maxBytes)
+	, mPriority(options.priority)
+	, mSlice(options.slice)
+	, mTransform(options.transform)
+	, mDataQueue(CreateQueue(options.maxBuffers, options.maxBytes, engine))
+	, mSpill(spill)
+{	
+}
+
+ISplitter::DataClient::DataClient(uint32_t clientId, const RingPtr& ring, const ClientOptions& options)
+	: mClientId(clientId)
+	, mEngine(Engine::Ring)
+	, mOverflowPolicy(options.policy)
+	, mMaxBuffers(options.maxBuffers)
+	, mMaxBytes(options.maxBytes)
+	, mPriority(options.priority)
+	, mSlice(options.slice)
+	, mTransform(options.transform)
+	, mRing(ring)
+	, mRingReader(ring->attach(options.policy != OverflowPolicy::Wait, options.maxBuffers, options.maxBytes))
+{
+}
+
+// A group member has no queue of its own; it keeps the group client's settings for its stats.
+ISplitter::DataClient::DataClient(uint32_t clientId, const std::shared_ptr<DataClient>& group, const ClientOptions& options)
+	: mClientId(clientId)
+	, mEngine(group->mEngine)
+	, mOverflowPolicy(group->mOverflowPolicy)
+	, mMaxBuffers(group->mMaxBuffers)
+	, mMaxBytes(group->mMaxBytes)
+	, mPriority(group->mPriority)
+	, mSlice(options.slice)
+	, mTransform(group->mTransform)
+	, mGroup(group)
+{
+}
+
+ISplitter::DataClient::~DataClient()
+{
+	if (mRing)
+		mRing->detach(mRingReader);
+
+#if defined(__linux__)
+	if (mEventFd >= 0)
+		close(mEventFd);
+#endif
+}
+
+ISplitter::DataClientPtr ISplitter::DataClient::Create(uint32_t clientId, Engine engine, const ClientOptions& options, const SpillFilePtr& spill)
+{
+	return std::make_shared<DataClient>(clientId, engine, options, spill);
+}
+
+ISplitter::DataClientPtr ISplitter::DataClient::Create(uint32_t clientId, const RingPtr& ring, const ClientOptions& options)
+{
+	return std::make_shared<DataClient>(clientId, ring, options);
+}
+
+ISplitter::DataClientPtr ISplitter::DataClient::Create(uint32_t clientId, const std::shared_ptr<DataClient>& group, const ClientOptions& options)
+{
+	return std::make_shared<DataClient>(clientId, group, options);
+}
+
+QueuePtr ISplitter::DataClient::CreateQueue(size_t maxBuffers, size_t maxBytes, Engine engine)
+{
+	if (engine == Engine::LockFreeQueue)
+		return std::make_shared<lockfree_queue<QueuedData>>(maxBuffers, maxBytes);
+
+	return std::make_shared<threadsafe_queue<QueuedData>>(maxBuffers, maxBytes);
+}
+
+const QueuePtr& ISplitter::DataClient::GetQueue() const
+{
+	return mDataQueue;
+}
+
+uint32_t ISplitter::DataClient::GetClientId() const
+{
+	return mClientId;
+}
+
+size_t ISplitter::DataClient::GetMaxBuffers() const
+{
+	return mMaxBuffers;
+}
+
+int32_t ISplitter::DataClient::GetPriority() const
+{
+	return mPriority;
+}
+
+const FrameTransformPtr& ISplitter::DataClient::GetTransform() const
+{
+	return mTransform;
+}
+
+size_t ISplitter::DataClient::GetDroppedCount() const
+{
+	if (mGroup)
+		return mGroup->GetDroppedCount();
+
+	// With the Ring engine mDropped only counts frames the splitter byte budget dropped.
+	size_t dropped = mRing ? mRing->dropped(*mRingReader) : 0;
+
+	return dropped + mDropped.load(memory_order_relaxed);
+}
+
+size_t ISplitter::DataClient::GetRetainedBytes() const
+{
+	if (mGroup)
+		return mGroup->GetRetainedBytes();
+
+	if (mRing)
+		return mRing->bytes(*mRingReader);
+
+	return GetQueue()->bytes();
+}
+
+size_t ISplitter::DataClient::GetLatencyCount() const
+{	
+	if (mGroup)
+		return mGroup->GetLatencyCount();
+
+	if (mRing)
+		return mRing->size(*mRingReader);
+
+	return GetQueue()->size() + GetSpilledCount();
+}
+
+// A full queue may give up more than one old frame for the new one when it has a byte budget,
+// so single frames go through PutDataBatch for the dropped count as well.
+int32_t ISplitter::DataClient::PutData(const QueuedData& data, int32_t nWaitForBuffersFreeTimeOutMsec)
+{
+	if (nWaitForBuffersFreeTimeOutMsec == -1)
+		return PutDataBatch(&data, 1, nullptr) ? static_cast<int32_t>(Error::DataDropped) : 0;
+
+	return PutDataUntil(data, chrono::steady_clock::now() + chrono::milliseconds(nWaitForBuffersFreeTimeOutMsec));
+}
+
+int32_t ISplitter::DataClient::PutDataUntil(const QueuedData& data, const std::chrono::steady_clock::time_point& deadline)
+{
+	return PutDataBatch(&data, 1, &deadline) ? static_cast<int32_t>(Error::DataDropped) : 0;
+}
+
+// A spilling client takes its frames in Put's second pass, which never waits for it.
+bool ISplitter::DataClient::TryPutData(const QueuedData& data)
+{
+	if (mSpill || !GetQueue()->try_push(data))
+		return false;
+
+	NotifyWaiters();
+	return true;
+}
+
+size_t ISplitter::DataClient::TryPutDataBatch(const QueuedData* data, size_t count)
+{
+	if (mSpill)
+		return 0;
+
+	const auto pushed = GetQueue()->try_push_batch(data, count);
+	if (pushed)
+		NotifyWaiters();
+
+	return pushed;
+}
+
+size_t ISplitter::DataClient::PutDataBatch(const QueuedData* data, size_t count, const std::chrono::steady_clock::time_point* pDeadline)
+{
+	if (mOverflowPolicy != OverflowPolicy::Wait)
+		return PutDataNoWait(data, count);
+
+	const auto start = chrono::steady_clock::now();
+	auto dropped = GetQueue()->push_batch(data, count, pDeadline);
+	mPutWait.Record(chrono::steady_clock::now() - start);
+	AddDropped(dropped);
+	NotifyWaiters();
+
+	return dropped;
+}
+
+// Full queue of a client that is never waited for: drops either the new frames
+// or the oldest queued ones. Returns the number of dropped frames.
+size_t ISplitter::DataClient::PutDataNoWait(const QueuedData* data, size_t count)
+{
+	if (mSpill)
+		return PutDataSpill(data, count);
+
+	const auto& queue = GetQueue();
+	const auto dropped = mOverflowPolicy == OverflowPolicy::DropNewest ?
+		count - queue->try_push_batch(data, count) : queue->push_evict_batch(data, count);
+	AddDropped(dropped);
+	NotifyWaiters();
+
+	return dropped;
+}
+
+// OverflowPolicy::Spill: frames go to the queue while it has room and nothing is spilled,
+// otherwise to the end of the spill file, so the queue always holds the oldest frames.
+// Get moves spilled frames back as it frees room. Returns the number of frames that fit nowhere.
+size_t ISplitter::DataClient::PutDataSpill(const QueuedData* data, size_t count)
+{
+	size_t dropped = 0;
+	{
+		scoped_lock lock(mSpillMutex);
+
+		size_t pushed = mSpill->IsEmpty() ? GetQueue()->try_push_batch(data, count) : 0;
+		for (; pushed < count; pushed++) {
+			if (!mSpill->Append(data[pushed]))
+				dropped++;
+		}
+	}
+
+	AddDropped(dropped);
+	NotifyWaiters();
+
+	return dropped;
+}
+
+// Called after Get took frames out of the queue; the file is only read while the queue has room.
+void ISplitter::DataClient::RefillFromSpill()
+{
+	if (!mSpill)
+		return;
+
+	scoped_lock lock(mSpillMutex);
+
+	const auto& queue = GetQueue();
+	QueuedData item;
+	while (!mSpill->IsEmpty() && queue->size() < mMaxBuffers && mSpill->Front(item) && queue->try_push(item))
+		mSpill->Pop();
+}
+
+size_t ISplitter::DataClient::GetSpilledCount() const
+{
+	if (mGroup)
+		return mGroup->GetSpilledCount();
+
+	if (!mSpill)
+		return 0;
+
+	scoped_lock lock(mSpillMutex);
+	return mSpill->GetCount();
+}
+
+void ISplitter::DataClient::AddDropped(size_t count)
+{
+	if (!count)
+		return;
+
+	mDropped.fetch_add(count, memory_order_relaxed);
+}
+
+void ISplitter::DataClient::GetStats(ClientStats* pStats) const
+{
+	auto toStats = [](const LatencyHistogram& histogram) {
+		auto usec = [](std::chrono::nanoseconds value) { return chrono::duration<double, micro>(value).count(); };
+
+		LatencyStats stats;
+		stats.count = histogram.GetCount();
+		stats.p50Usec = usec(histogram.GetPercentile(0.5));
+		stats.p99Usec = usec(histogram.GetPercentile(0.99));
+		stats.p999Usec = usec(histogram.GetPercentile(0.999));
+		stats.maxUsec = usec(histogram.GetMax());
+		return stats;
+	};
+
+	pStats->maxBuffers = mMaxBuffers;
+	pStats->maxBytes = mMaxBytes;
+	pStats->retainedBytes = GetRetainedBytes();
+	pStats->priority = mPriority;
+	pStats->latency = GetLatencyCount();
+	pStats->dropped = GetDroppedCount();
+	pStats->spilled = GetSpilledCount();
+	pStats->endToEnd = toStats(mEndToEnd);
+	pStats->putWait = toStats(mGroup ? mGroup->mPutWait : mPutWait);
+	pStats->getWait = toStats(mGetWait);
+}
+
+bool ISplitter::DataClient::IsRemoved() const
+{
+	return mRemoved;
+}
+
+int32_t ISplitter::DataClient::GetData(DataPtr& data, const std::chrono::steady_clock::time_point* pDeadline)
+{
+	QueuedData item;
+	auto error = GetItem(item, pDeadline);
+	if (!error)
+		data = std::move(item.data);
+
+	return error;
+}
+
+int32_t ISplitter::DataClient::GetData(Frame& frame, const std::chrono::steady_clock::time_point* pDeadline)
+{
+	QueuedData item;
+	auto error = GetItem(item, pDeadline);
+	if (!error)
+		frame = ToFrame(std::move(item));
+
+	return error;
+}
+
+int32_t ISplitter::DataClient::GetData(FrameView& view, const std::chrono::steady_clock::time_point* pDeadline)
+{
+	QueuedData item;
+	auto error = GetItem(item, pDeadline);
+	if (!error)
+		view = ToView(std::move(item));
+
+	return error;
+}
+
+int32_t ISplitter::DataClient::TryGetData(DataPtr& data)
+{
+	QueuedData item;
+	auto error = TryGetItem(item);
+	if (!error)
+		data = std::move(item.data);
+
+	return error;
+}
+
+int32_t ISplitter::DataClient::TryGetData(Frame& frame)
+{
+	QueuedData item;
+	auto error = TryGetItem(item);
+	if (!error)
+		frame = ToFrame(std::move(item));
+
+	return error;
+}
+
+int32_t ISplitter::DataClient::TryGetData(FrameView& view)
+{
+	QueuedData item;
+	auto error = TryGetItem(item);
+	if (!error)
+		view = ToView(std::move(item));
+
+	return error;
+}
+
+int32_t ISplitter::DataClient::GetDataBatch(DataPtrList& dataList, size_t maxCount, const std::chrono::steady_clock::time_point* pDeadline)
+{
+	dataList.clear();
+
+	QueuedDataList items;
+	auto error = GetItemBatch(items, maxCount, pDeadline);
+	for (auto& item : items)
+		dataList.push_back(std::move(item.data));
+
+	return error;
+}
+
+int32_t ISplitter::DataClient::GetDataBatch(FrameList& frameList, size_t maxCount, const std::chrono::steady_clock::time_point* pDeadline)
+{
+	frameList.clear();
+
+	QueuedDataList items;
+	auto error = GetItemBatch(items, maxCount, pDeadline);
+	for (auto& item : items)
+		frameList.push_back(ToFrame(std::move(item)));
+
+	return error;
+}
+
+int32_t ISplitter::DataClient::GetDataBatch(FrameViewList& viewList, size_t maxCount, const std::chrono::steady_clock::time_point* pDeadline)
+{
+	viewList.clear();
+
+	QueuedDataList items;
+	auto error = GetItemBatch(items, maxCount, pDeadline);
+	for (auto& item : items)
+		viewList.push_back(ToView(std::move(item)));
+
+	return error;
+}
+
+int32_t ISplitter::DataClient::GetItem(QueuedData& item, const std::chrono::steady_clock::time_point* pDeadline)
+{
+	if (mRemoved)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	auto& owner = GetQueueOwner();
+	if (!owner.PopData(item, pDeadline, mGetWait)) {
+		ResetEvent();
+		return static_cast<int32_t>(Error::NoNewData);
+	}
+
+	owner.RefillFromSpill();
+	ResetEventIfEmpty();
+	ApplyTransform(item);
+	RecordDelivery(item, chrono::steady_clock::now());
+
+	return 0;
+}
+
+int32_t ISplitter::DataClient::TryGetItem(QueuedData& item)
+{
+	if (mRemoved)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	auto& owner = GetQueueOwner();
+	if (!owner.TryPopData(item) || !owner.DiscardStale(item)) {
+		ResetEvent();
+		return static_cast<int32_t>(Error::NoNewData);
+	}
+
+	owner.RefillFromSpill();
+	ResetEventIfEmpty();
+	ApplyTransform(item);
+	RecordDelivery(item, chrono::steady_clock::now());
+
+	return 0;
+}
+
+int32_t ISplitter::DataClient::GetItemBatch(QueuedDataList& items, size_t maxCount, const std::chrono::steady_clock::time_point* pDeadline)
+{
+	if (!maxCount)
+		return 0;
+
+	QueuedData first;
+	auto error = GetItem(first, pDeadline);
+	if (error)
+		return error;
+
+	items.push_back(std::move(first));
+
+	auto& owner = GetQueueOwner();
+	if (owner.mRing)
+		owner.mRing->try_pop_batch(*owner.mRingReader, items, maxCount - 1);
+	else
+		owner.GetQueue()->try_pop_batch(items, maxCount - 1);
+
+	owner.RefillFromSpill();
+	ResetEventIfEmpty();
+
+	const auto flushEpoch = owner.mFlushEpoch.load(memory_order_seq_cst);
+	items.erase(std::remove_if(begin(items) + 1, end(items),
+		[flushEpoch](const QueuedData& item) { return item.flushEpoch < flushEpoch; }), end(items));
+
+	for (size_t i = 1; i < items.size(); i++)
+		ApplyTransform(items[i]);
+
+	const auto now = chrono::steady_clock::now();
+	for (size_t i = 1; i < items.size(); i++)
+		RecordDelivery(items[i], now);
+
+	return 0;
+}
+
+// Frames hand out the payload and metadata only; the byte budget share goes with the item.
+Frame ISplitter::DataClient::ToFrame(QueuedData&& item)
+{
+	return Frame{ std::move(item.data), item.sequence, item.putTime, std::move(item.tags) };
+}
+
+// The slice only computes where the client's region lies; the payload stays where Put left it.
+FrameView ISplitter::DataClient::ToView(QueuedData&& item) const
+{
+	auto view = FrameView::Make(std::move(item.data), mSlice);
+	view.sequence = item.sequence;
+	view.putTime = item.putTime;
+	view.tags = std::move(item.tags);
+	return view;
+}
+
+// Pops the next frame, waiting for it if there is none yet. Only the waiting is timed.
+bool ISplitter::DataClient::PopData(QueuedData& item, const std::chrono::steady_clock::time_point* pDeadline, LatencyHistogram& getWait)
+{
+	if (TryPopData(item))
+		return DiscardStale(item);
+
+	const auto start = chrono::steady_clock::now();
+	const auto result = mRing ?
+		mRing->wait_and_pop_until(*mRingReader, item, pDeadline) : GetQueue()->wait_and_pop_until(item, pDeadline);
+	getWait.Record(chrono::steady_clock::now() - start);
+
+	return result && DiscardStale(item);
+}
+
+bool ISplitter::DataClient::TryPopData(QueuedData& item)
+{
+	return mRing ? mRing->try_pop(*mRingReader, item) : GetQueue()->try_pop(item);
+}
+
+// A Put racing with Flush may queue a frame of the old epoch after the client was cleared.
+// Such frames are dropped here; false if nothing newer is queued behind them.
+bool ISplitter::DataClient::DiscardStale(QueuedData& item)
+{
+	const auto flushEpoch = mFlushEpoch.load(memory_order_seq_cst);
+	while (item.flushEpoch < flushEpoch) {
+		if (!TryPopData(item))
+			return false;
+	}
+
+	return true;
+}
+
+void ISplitter::DataClient::RecordDelivery(const QueuedData& item, std::chrono::steady_clock::time_point now)
+{
+	mEndToEnd.Record(now - item.putTime);
+}
+
+// Swaps the payload for the result of the client's transform stage. A stage the executor has
+// not started yet runs here; one another thread is running is waited for. A frame put before the
+// stage started for the client is transformed here as well.
+void ISplitter::DataClient::ApplyTransform(QueuedData& item) const
+{
+	if (!mTransform)
+		return;
+
+	if (item.transformed) {
+		for (const auto& task : *item.transformed) {
+			if (task->transform == mTransform) {
+				RunTransform(*task);
+				item.data = task->result.get();
+				return;
+			}
+		}
+	}
+
+	item.data = RunTransform(*mTransform, Frame{ item.data, item.sequence, item.putTime, item.tags });
+}
+
+void ISplitter::DataClient::FlushData(uint64_t flushEpoch)
+{
+	mFlushEpoch.store(flushEpoch, memory_order_seq_cst);
+
+	if (mRing) {
+		mRing->flush(*mRingReader);
+	}
+	else if (mSpill) {
+		scoped_lock lock(mSpillMutex);
+		mSpill->Clear();
+		GetQueue()->clear();
+	}
+	else {
+		GetQueue()->clear();
+	}
+
+	mDropped.store(0, memory_order_relaxed);
+}
+
+void ISplitter::DataClient::Disconnect()
+{
+	mRemoved = true;
+
+	// A group member has no queue, only its waiters to wake.
+	if (!mGroup) {
+		if (mRing)
+			mRing->detach(mRingReader);
+		else
+			GetQueue()->flush();
+
+		if (mSpill) {
+			scoped_lock lock(mSpillMutex);
+			mSpill->Clear();
+		}
+
+		// Puts that still see the client in an old list must not wait for its turns any more.
+		mPutTurn.open();
+	}
+
+	NotifyWaiters();
+}
+
+const ISplitter::DataClientPtr& ISplitter::DataClient::GetGroup() const
+{
+	return mGroup;
+}
+
+void ISplitter::DataClient::AddMember(const std::shared_ptr<DataClient>& member)
+{
+	auto members = std::make_shared<MemberList>(*std::atomic_load(&mMembers));
+	members->push_back(member);
+	std::atomic_store(&mMembers, std::shared_ptr<const MemberList>(std::move(members)));
+	mHasMembers = true;
+}
+
+void ISplitter::DataClient::RemoveMember(const std::shared_ptr<DataClient>& member)
+{
+	auto members = std::make_shared<MemberList>(*std::atomic_load(&mMembers));
+	members->erase(std::find(begin(*members), end(*members), member));
+	mHasMembers = !members->empty();
+	std::atomic_store(&mMembers, std::shared_ptr<const MemberList>(std::move(members)));
+}
+
+std::vector<ISplitter::DataClientPtr> ISplitter::DataClient::TakeMembers()
+{
+	mHasMembers = false;
+	auto members = std::atomic_exchange(&mMembers, std::make_shared<const MemberList>());
+	return *members;
+}
+
+// The client whose queue Get pops from: the group client for a member, otherwise this one.
+ISplitter::DataClient& ISplitter::DataClient::GetQueueOwner()
+{
+	return mGroup ? *mGroup : *this;
+}
+
+void ISplitter::DataClient::AddWaiter(std::function<void()> waiter)
+{
+	{
+		scoped_lock lock(mWaitersMutex);
+		mWaiters.push_back(std::move(waiter));
+		mHasWaiters = true;
+	}
+
+	// A Put that came before the waiter was visible did not run it; pairs with the fence in NotifyWaiters.
+	atomic_thread_fence(memory_order_seq_cst);
+	if (mRemoved || HasData())
+		NotifyWaiters();
+}
+
+void ISplitter::DataClient::NotifyWaiters()
+{
+	// Put calls this for every frame, without waiters or members it is a fence and two loads.
+	atomic_thread_fence(memory_order_seq_cst);
+	if (mHasMembers.load(memory_order_relaxed)) {
+		for (const auto& member : *std::atomic_load(&mMembers))
+			member->NotifyWaiters();
+	}
+
+	if (!mHasWaiters.load(memory_order_relaxed))
+		return;
+
+	std::vector<std::function<void()>> waiters;
+	{
+		scoped_lock lock(mWaitersMutex);
+		waiters.swap(mWaiters);
+		mHasWaiters = false;
+	}
+
+	for (auto& waiter : waiters)
+		waiter();
+}
+
+bool ISplitter::DataClient::HasData() const
+{
+	if (mGroup)
+		return mGroup->HasData();
+
+	if (mRing)
+		return mRing->size(*mRingReader) > 0;
+
+	return !GetQueue()->empty();
+}
+
+// The client being delivered on this thread, so that ending its subscription from its own
+// callback does not wait for itself.
+static thread_local const void* DeliveringClient = nullptr;
+
+// Fails for a client that already has a subscription or was removed. Disconnect sets mRemoved
+// before EndSubscription takes the mutex, so either it sees the callback or this sees mRemoved.
+bool ISplitter::DataClient::SetSubscribed(DataCallback callback)
+{
+	scoped_lock lock(mDeliverMutex);
+	if (mCallback || mRemoved)
+		return false;
+
+	mCallback = std::move(callback);
+	return true;
+}
+
+// Runs the callback for up to maxCount frames and returns the error that stopped it,
+// Error::NoClientFound once the subscription has ended.
+int32_t ISplitter::DataClient::DeliverData(size_t maxCount)
+{
+	scoped_lock lock(mDeliverMutex);
+	if (mSubscriptionEnded)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	DataPtr data;
+	int32_t error = 0;
+	for (size_t count = 0; count < maxCount; count++) {
+		error = TryGetData(data);
+		if (error)
+			break;
+
+		CallSubscriber(error, data);
+		data.reset();
+	}
+
+	if (error == static_cast<int32_t>(Error::NoClientFound))
+		EndSubscriptionLocked();
+
+	return error;
+}
+
+// Makes the final call unless a delivery did, after waiting for one in progress. From a
+// callback it does not wait: for its own client the delivery makes the final call when
+// the callback returns, and waiting for another client could wait for this very thread.
+void ISplitter::DataClient::EndSubscription()
+{
+	if (DeliveringClient == this)
+		return;
+
+	unique_lock lock(mDeliverMutex, defer_lock);
+	if (!DeliveringClient)
+		lock.lock();
+	else if (!lock.try_lock())
+		return;
+
+	EndSubscriptionLocked();
+}
+
+void ISplitter::DataClient::EndSubscriptionLocked()
+{
+	if (mSubscriptionEnded || !mCallback)
+		return;
+
+	mSubscriptionEnded = true;
+	CallSubscriber(static_cast<int32_t>(Error::NoClientFound), DataPtr());
+}
+
+void ISplitter::DataClient::CallSubscriber(int32_t errorId, const DataPtr& data)
+{
+	auto outer = DeliveringClient;
+	DeliveringClient = this;
+	mCallback(errorId, data);
+	DeliveringClient = outer;
+}
+
+void ISplitter::DataClient::WaitPutTurn(uint64_t sequence)
+{
+	mPutTurn.wait(sequence);
+}
+
+void ISplitter::DataClient::PassPutTurn(uint64_t sequence)
+{
+	mPutTurn.pass(sequence);
+}
+
+// Until the first sequence is set the client is in the list but Put cannot tell yet
+// whether its sequence comes before; that only lasts for two statements of ClientAddImpl.
+bool ISplitter::DataClient::TakesSequence(uint64_t sequence) const
+{
+	uint64_t firstSequence;
+	while ((firstSequence = mFirstSequence.load(memory_order_acquire)) == NoSequence)
+		this_thread::yield();
+
+	return sequence >= firstSequence;
+}
+
+void ISplitter::DataClient::SetFirstSequence(uint64_t sequence)
+{
+	mPutTurn.reset(sequence);
+	mFirstSequence.store(sequence, memory_order_release);
+}
+
+// The caller gets a duplicate of the client's eventfd, so the descriptor it registered stays
+// valid (and keeps the removal signal) however long the client object itself lives on.
+int ISplitter::DataClient::GetEventFd()
+{
+#if defined(__linux__)
+	{
+		scoped_lock lock(mClientInfoMutex);
+		if (mEventFdTaken)
+			return -1;
+
+		if (mEventFd < 0)
+			mEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (mEventFd < 0)
+			return -1;
+
+		mEventFdTaken = true;
+	}
+
+	ArmEvent();
+
+	return fcntl(mEventFd, F_DUPFD_CLOEXEC, 0);
+#else
+	return -1;
+#endif
+}
+
+// The event is a one-shot waiter that signals the eventfd. It is armed again only when
+// a Get empties the client or finds it empty, so Put pays nothing while the consumer is behind.
+void ISplitter::DataClient::ArmEvent()
+{
+#if defined(__linux__)
+	if (mEventFd < 0 || mEventArmed.exchange(true))
+		return;
+
+	AddWaiter([this] {
+		mEventArmed = false;
+
+		const uint64_t signal = 1;
+		[[maybe_unused]] auto written = write(mEventFd, &signal, sizeof(signal));
+	});
+#endif
+}
+
+// Clears the eventfd, then arms it again; AddWaiter signals it right away when a frame
+// came in after the Get that found none.
+void ISplitter::DataClient::ResetEvent()
+{
+#if defined(__linux__)
+	if (mEventFd < 0)
+		return;
+
+	uint64_t signals = 0;
+	[[maybe_unused]] auto bytesRead = ::read(mEventFd, &signals, sizeof(signals));
+
+	ArmEvent();
+#endif
+}
+
+// After a Get took frames: without an eventfd this is one load.
+void ISplitter::DataClient::ResetEventIfEmpty()
+{
+	if (mEventFd >= 0 && !HasData())
+		ResetEvent();
+}
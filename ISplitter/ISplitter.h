@@ -1,18 +1,134 @@
 #pragma once
 
 #include "threadsafe_queue.h"
+#include "lockfree_queue.h"
+#include "broadcast_ring.h"
+#include "BufferPool.h"
+#include "LatencyHistogram.h"
+#include "byte_budget.h"
+#include "Executor.h"
+#include "turnstile.h"
 
 #include <memory>
 #include <vector>
-#include <deque>
-#include <shared_mutex>
+#include <functional>
+#include <map>
+#include <string>
+#include <future>
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
 
 using ClientIds = std::vector<uint32_t>;
 using DataArray = std::vector<uint8_t>;
 using DataPtr = std::shared_ptr<DataArray>;
 using DataPtrList = std::vector<DataPtr>;
-using Queue = threadsafe_queue<DataPtr>;
-using QueuePtr = std::unique_ptr<Queue>;
+using FrameTags = std::map<std::string, std::string>;
+using FrameTagsPtr = std::shared_ptr<const FrameTags>;
+
+// Frame as Get returns it, with the metadata Put gave it.
+// sequence - number of the frame among all frames put into the splitter, from 0. A client that
+//            skips sequences lost exactly those frames (with several producers only under
+//            ISplitter::PutOrder::Sequenced, otherwise their frames may arrive out of order).
+// putTime  - when Put took the frame.
+// tags     - user tags passed to Put, nullptr if none. Shared by all clients, read-only.
+struct Frame {
+	DataPtr data;
+	uint64_t sequence = 0;
+	std::chrono::steady_clock::time_point putTime;
+	FrameTagsPtr tags;
+};
+
+using FrameList = std::vector<Frame>;
+
+// Region of the frame payload a client reads, see ISplitter::ClientOptions::slice.
+// offset - first byte of the region.
+// length - bytes per row, 0 - everything from offset to the end of the frame as a single row.
+// stride - bytes from the start of one row to the start of the next, 0 - rows follow each other.
+// rows   - number of rows, 0 - as many as fit into the frame.
+// The default slice is the whole frame.
+struct FrameSlice {
+	size_t offset = 0;
+	size_t length = 0;
+	size_t stride = 0;
+	size_t rows = 1;
+};
+
+// Frame as Get returns it for a view: a slice of the payload that shares ownership of the
+// frame buffer instead of copying out of it, so clients with different slices read their
+// part of the same frame in place. Rows of the slice that do not fit into the frame are left
+// out; a slice past the end of the frame has no rows. Metadata as in Frame.
+struct FrameView {
+	DataPtr parent;
+	size_t offset = 0;
+	size_t length = 0;
+	size_t stride = 0;
+	size_t rows = 0;
+	uint64_t sequence = 0;
+	std::chrono::steady_clock::time_point putTime;
+	FrameTagsPtr tags;
+
+	// View of slice of data, without metadata.
+	static FrameView Make(DataPtr data, const FrameSlice& slice);
+
+	// First byte of row index (length bytes), nullptr past the last row.
+	const uint8_t* GetRow(size_t index) const;
+	// Bytes in the view, length * rows.
+	size_t GetSize() const;
+	// Copies the rows into one contiguous array.
+	DataArray ToArray() const;
+};
+
+using FrameViewList = std::vector<FrameView>;
+
+// Transform stage, see ISplitter::ClientOptions::transform. Returns the payload the clients
+// of the stage get instead of frame.data; may return frame.data itself. A transform that
+// throws hands its clients nullptr.
+using FrameTransform = std::function<DataPtr(const Frame& frame)>;
+using FrameTransformPtr = std::shared_ptr<const FrameTransform>;
+
+// One transform stage of a frame. It runs once: on the splitter's executor, or on the first Get
+// that needs the result before the executor got to it. claimed is set by whichever runs it.
+struct TransformTask {
+	FrameTransformPtr transform;
+	Frame frame;
+	std::atomic_bool claimed{ false };
+	std::promise<DataPtr> promise;
+	std::shared_future<DataPtr> result;
+};
+
+using TransformTaskPtr = std::shared_ptr<TransformTask>;
+using TransformResults = std::vector<TransformTaskPtr>;
+
+// Frame as it waits in a client queue (or ring slot), stamped when it was put.
+// sequence numbers the frames of a splitter in the order Put took them.
+// With a splitter byte budget, budget holds the frame's share of it until the last queue drops the frame.
+struct QueuedData {
+	DataPtr data;
+	std::chrono::steady_clock::time_point putTime;
+	std::shared_ptr<void> budget;
+	uint64_t sequence = 0;
+	FrameTagsPtr tags;
+	// Flush epoch the frame was put in; frames of an earlier epoch are discarded on Get.
+	uint64_t flushEpoch = 0;
+	// Transform stages started for the frame, one per stage of the clients it was put to.
+	std::shared_ptr<const TransformResults> transformed;
+};
+
+inline size_t value_bytes(const QueuedData& item)
+{
+	return item.data ? item.data->size() : 0;
+}
+
+using QueuedDataList = std::vector<QueuedData>;
+using Queue = data_queue<QueuedData>;
+using QueuePtr = std::shared_ptr<Queue>;
+using Ring = broadcast_ring<QueuedData>;
+using RingPtr = std::shared_ptr<Ring>;
+
+class SpillFile;
+using SpillFilePtr = std::shared_ptr<SpillFile>;
 
 class ISplitter;
 
@@ -20,29 +136,266 @@ using ISplitterPtr = std::shared_ptr<ISplitter>;
 
 class ISplitter 
 {
+private:
+	class DataClient;
+
 public: 
-	enum class Error{ NoError = 0, MaxClientsReached, DataDropped, DataFlushed, NoNewData, NoClientFound, NoClients, Count };
+	enum class Error{ NoError = 0, MaxClientsReached, DataDropped, DataFlushed, NoNewData, NoClientFound, NoClients, FrameTooLarge, Count };
+
+	// Queue         - every client owns a queue of up to maxBuffers frames, Put copies the frame into each of them.
+	// Ring          - frames are stored once in a shared ring of maxBuffers slots, clients only keep a read cursor.
+	// LockFreeQueue - same as Queue, but the per-client queues are lock-free MPMC rings; like Queue it takes
+	//                 any number of Put and Get threads.
+	enum class Engine{ Queue = 0, Ring, LockFreeQueue };
+
+	// How frames of concurrent Put calls are ordered:
+	// Any       - every Put delivers to the clients on its own, two clients may get the frames of two
+	//             producers in different orders (the Ring engine always keeps one order).
+	// Sequenced - each frame takes the next sequence number when Put starts delivering it, and every
+	//             client receives the frames in sequence order. Producers only wait for each other per
+	//             client: a Put may fill one client while the previous one still waits on another.
+	enum class PutOrder{ Any = 0, Sequenced };
+
+	// What Put does when a client's buffers are full, chosen per client at ClientAdd:
+	// Wait       - waits up to the Put timeout for a free buffer, then drops the oldest frame.
+	// DropOldest - drops the oldest queued frame right away, Put never waits for the client.
+	// DropNewest - drops the new frame right away. The Ring engine has to reuse the oldest
+	//              slot for the new frame, so there it works as DropOldest.
+	// Spill      - frames beyond the queue depth go to the client's spill file and Get reads them
+	//              back in order, Put never waits and no frame is lost until the file is full;
+	//              then new frames are dropped. Not available with the Ring engine.
+	enum class OverflowPolicy{ Wait = 0, DropOldest, DropNewest, Spill };
+
+	// maxBuffers - queue depth of the client, 0 - the splitter's maxBuffers. With the Ring engine
+	//              the depth can only be lowered, the ring has maxBuffers slots.
+	// maxBytes   - byte budget of the queued frames, 0 - none. A full budget counts as full buffers
+	//              for the overflow policy; an empty queue always takes one frame.
+	// priority   - Put serves clients with a higher priority first (fills their buffers first
+	//              and waits for them first), clients of equal priority in the order of ClientAdd.
+	// spillPath  - OverflowPolicy::Spill: file the client spills to, created by ClientAdd and
+	//              removed with the client. ClientAdd fails if it cannot be created or already
+	//              exists; an existing file is left as it is.
+	// spillBytes - OverflowPolicy::Spill: size of the spill file, reserved on disk up front.
+	// slice      - region of each frame the FrameView versions of Get return, applied to the
+	//              frame when it is taken. The other Get versions return the whole frame.
+	// transform  - stage whose result the client gets instead of the frame payload. Put posts
+	//              it to the executor (see SetExecutor) once per frame for all clients sharing
+	//              the same FrameTransformPtr, so they share one result. Get waits for a stage
+	//              that is running and runs one the executor has not started yet itself.
+	//              The stage is skipped for a frame no client holds any more (dropped or flushed).
+	//              A frame the stage did not start for (read back from a spill file, or put
+	//              while the client was being added) is transformed by Get.
+	// group      - ID of a client to join as a member of its consumer group, 0 - none. A member
+	//              gets its own ID and Get statistics, but no queue and no place in Put's fan-out:
+	//              Get on any member or on the group client takes the next frame of the group
+	//              client's queue, so each frame goes to one of them. The queue options above are
+	//              the group client's, only slice is the member's own. Members count against
+	//              maxClients, are not listed by ClientGetByIndex and are removed with the group
+	//              client.
+	struct ClientOptions {
+		size_t maxBuffers = 0;
+		size_t maxBytes = 0;
+		OverflowPolicy policy = OverflowPolicy::Wait;
+		int32_t priority = 0;
+		std::string spillPath;
+		size_t spillBytes = 0;
+		FrameSlice slice;
+		FrameTransformPtr transform;
+		uint32_t group = 0;
+	};
+
+	// Duration distribution in microseconds. Percentiles are accurate to about 3%, max is exact.
+	struct LatencyStats {
+		uint64_t count = 0;
+		double p50Usec = 0;
+		double p99Usec = 0;
+		double p999Usec = 0;
+		double maxUsec = 0;
+	};
+
+	// Per-client statistics, accumulated since the client was added. For a consumer group member
+	// endToEnd and getWait are those of its own Gets, the rest are the group client's.
+	// endToEnd - from Put to the Get that returned the frame.
+	// putWait  - Put blocked on this client's full queue (not recorded per client by the Ring engine,
+	//            where Put waits on the shared ring).
+	// getWait  - Get blocked waiting for a new frame, including timeouts.
+	// spilled  - frames waiting in the spill file, included in latency.
+	struct ClientStats {
+		size_t maxBuffers = 0;
+		size_t maxBytes = 0;
+		int32_t priority = 0;
+		size_t latency = 0;
+		size_t retainedBytes = 0;
+		size_t dropped = 0;
+		size_t spilled = 0;
+		LatencyStats endToEnd;
+		LatencyStats putWait;
+		LatencyStats getWait;
+	};
+
+	// Direct reference to one client for the consumer side, returned by ClientAdd()
+	// (not valid if no client could be added). Get calls through the handle skip the client
+	// registry. Once the client is removed (or the splitter closed) every call returns
+	// Error::NoClientFound.
+	class ClientHandle final {
+	public:
+		ClientHandle() = default;
+
+		uint32_t GetClientId() const;
+		bool IsValid() const;
+
+		int32_t Get(DataPtr& data, int32_t nWaitForNewDataTimeOutMsec) const;
+		int32_t Get(Frame& frame, int32_t nWaitForNewDataTimeOutMsec) const;
+		// See ISplitter::Get() with a duration and ISplitter::GetUntil().
+		template <class Rep, class Period>
+		int32_t Get(DataPtr& data, const std::chrono::duration<Rep, Period>& timeout) const { return GetUntil(data, DeadlineAfter(timeout)); }
+		template <class Rep, class Period>
+		int32_t Get(Frame& frame, const std::chrono::duration<Rep, Period>& timeout) const { return GetUntil(frame, DeadlineAfter(timeout)); }
+		int32_t GetUntil(DataPtr& data, const std::chrono::steady_clock::time_point& deadline) const;
+		int32_t GetUntil(Frame& frame, const std::chrono::steady_clock::time_point& deadline) const;
+		int32_t TryGet(DataPtr& data) const;
+		int32_t TryGet(Frame& frame) const;
+		int32_t Get(FrameView& view, int32_t nWaitForNewDataTimeOutMsec) const;
+		int32_t TryGet(FrameView& view) const;
+		int32_t GetBatch(DataPtrList& dataList, size_t maxCount, int32_t nWaitForNewDataTimeOutMsec) const;
+		int32_t GetBatch(FrameList& frameList, size_t maxCount, int32_t nWaitForNewDataTimeOutMsec) const;
+		int32_t GetBatch(FrameViewList& viewList, size_t maxCount, int32_t nWaitForNewDataTimeOutMsec) const;
+		// See ISplitter::ClientGetEventFd().
+		int GetEventFd() const;
+
+	private:
+		friend class ISplitter;
+
+		explicit ClientHandle(std::shared_ptr<DataClient> client);
+
+		std::shared_ptr<DataClient> mClient;
+	};
+
+	// Frame (errorId 0) or the end of the subscription (Error::NoClientFound, data nullptr)
+	// of a subscribed client. See Subscribe().
+	using DataCallback = std::function<void(int32_t errorId, const DataPtr& data)>;
+
+#if defined(__cpp_impl_coroutine)
+	// Awaitable returned by GetAsync(). Suspends without holding a thread until the client has
+	// a frame, then resumes on the splitter's executor; co_await yields the Get error code.
+	class GetAwaiter final {
+	public:
+		bool await_ready();
+		void await_suspend(std::coroutine_handle<> handle);
+		int32_t await_resume() const;
+
+	private:
+		friend class ISplitter;
+
+		GetAwaiter(std::shared_ptr<DataClient> client, ExecutorPtr executor, DataPtr& data);
+
+		void Wait();
+
+		std::shared_ptr<DataClient> mClient;
+		ExecutorPtr mExecutor;
+		DataPtr& mData;
+		std::coroutine_handle<> mHandle;
+		int32_t mError = 0;
+	};
+#endif
 
 public:
-	ISplitter(size_t maxBuffers, size_t maxClients);
+	// Most clients a splitter takes, group members included (client IDs keep 16 bits for the slot).
+	static constexpr size_t MaxClients = 65536;
+
+	// maxClients - at most MaxClients, a larger value is clamped to it; InfoGet reports the one in effect.
+	// maxBytes   - byte budget of all frames held in the client queues, a frame shared by several
+	//              clients counts once; 0 - none. Put waits for the budget within its timeout and
+	//              drops the frame for every client when it does not fit.
+	ISplitter(size_t maxBuffers, size_t maxClients, Engine engine = Engine::Queue, size_t maxBytes = 0, PutOrder putOrder = PutOrder::Any);
 	virtual ~ISplitter();
 
 	static std::string GetErrorText(int32_t errorId);
 
 public:	
-	static ISplitterPtr Create(size_t maxBuffers, size_t maxClients);
+	static ISplitterPtr Create(size_t maxBuffers, size_t maxClients, Engine engine = Engine::Queue, size_t maxBytes = 0, PutOrder putOrder = PutOrder::Any);
 
 	bool InfoGet(size_t* pMaxBuffers, size_t* pMaxClients) const;
+	// Byte budget of the splitter (0 - none) and the bytes held in the client queues.
+	bool InfoGetBytes(size_t* pMaxBytes, size_t* pRetainedBytes) const;
+
+	// Frame buffer from the splitter's pool; it returns to the pool when the last reference is dropped.
+	DataPtr AcquireBuffer(size_t size);
 
-	bool ClientAdd(uint32_t* pClientID);
+	bool ClientAdd(uint32_t* pClientID, OverflowPolicy policy = OverflowPolicy::Wait);
+	ClientHandle ClientAdd(OverflowPolicy policy = OverflowPolicy::Wait);
+	bool ClientAdd(uint32_t* pClientID, const ClientOptions& options);
+	ClientHandle ClientAdd(const ClientOptions& options);
 	bool ClientRemove(uint32_t clientID);
 
 	bool ClientGetCount(size_t* pCount) const;
 	bool ClientGetByIndex(size_t index, uint32_t* pClientID, size_t* pLatency, size_t* pDropped) const;
 	bool ClientGetById(uint32_t clientID, size_t* pLatency, size_t* pDropped) const;
+	bool ClientGetStats(uint32_t clientID, ClientStats* pStats) const;
 
 	int32_t Put(const DataPtr& data, int32_t nWaitForBuffersFreeTimeOutMsec);
+	int32_t Put(const DataPtr& data, FrameTagsPtr tags, int32_t nWaitForBuffersFreeTimeOutMsec);
 	int32_t Get(uint32_t nClientID, DataPtr& data, int32_t nWaitForNewDataTimeOutMsec);
+	int32_t Get(uint32_t nClientID, Frame& frame, int32_t nWaitForNewDataTimeOutMsec);
+	// Get that never waits: Error::NoNewData if the client has no frame.
+	int32_t TryGet(uint32_t nClientID, DataPtr& data);
+	int32_t TryGet(uint32_t nClientID, Frame& frame);
+	// Get of the client's slice of the frame (ClientOptions::slice), without copying the payload.
+	int32_t Get(uint32_t nClientID, FrameView& view, int32_t nWaitForNewDataTimeOutMsec);
+	int32_t TryGet(uint32_t nClientID, FrameView& view);
+
+	// Put and Get with the timeout as a std::chrono duration, e.g. Put(data, 1500us): waits are
+	// timed on steady_clock to its full resolution instead of whole milliseconds. The Until
+	// versions wait up to an absolute steady_clock deadline, so a frame loop can hand one
+	// deadline to several calls; a deadline in the past means no wait.
+	template <class Rep, class Period>
+	int32_t Put(const DataPtr& data, const std::chrono::duration<Rep, Period>& timeout) { return PutUntil(data, FrameTagsPtr(), DeadlineAfter(timeout)); }
+	template <class Rep, class Period>
+	int32_t Put(const DataPtr& data, FrameTagsPtr tags, const std::chrono::duration<Rep, Period>& timeout) { return PutUntil(data, std::move(tags), DeadlineAfter(timeout)); }
+	template <class Rep, class Period>
+	int32_t Get(uint32_t nClientID, DataPtr& data, const std::chrono::duration<Rep, Period>& timeout) { return GetUntil(nClientID, data, DeadlineAfter(timeout)); }
+	template <class Rep, class Period>
+	int32_t Get(uint32_t nClientID, Frame& frame, const std::chrono::duration<Rep, Period>& timeout) { return GetUntil(nClientID, frame, DeadlineAfter(timeout)); }
+
+	int32_t PutUntil(const DataPtr& data, const std::chrono::steady_clock::time_point& deadline);
+	int32_t PutUntil(const DataPtr& data, FrameTagsPtr tags, const std::chrono::steady_clock::time_point& deadline);
+	int32_t GetUntil(uint32_t nClientID, DataPtr& data, const std::chrono::steady_clock::time_point& deadline);
+	int32_t GetUntil(uint32_t nClientID, Frame& frame, const std::chrono::steady_clock::time_point& deadline);
+
+	// Linux eventfd of the client for epoll/poll loops, -1 elsewhere or on failure. It is readable
+	// while the client has frames and once the client is removed; a Get or TryGet that takes the
+	// last frame, or finds none, clears it. Hands the descriptor over: call it once per client and
+	// keep the result, later calls return -1. The caller closes it when done, also after
+	// ClientRemove or Close.
+	int ClientGetEventFd(uint32_t clientID);
+
+	// Batch versions of Put and Get: every client is locked once per batch instead of once per frame.
+	// PutBatch reports the number of frames dropped across all clients in *pDropped.
+	int32_t PutBatch(const DataPtrList& dataList, int32_t nWaitForBuffersFreeTimeOutMsec, size_t* pDropped = nullptr);
+	int32_t GetBatch(uint32_t nClientID, DataPtrList& dataList, size_t maxCount, int32_t nWaitForNewDataTimeOutMsec);
+	int32_t GetBatch(uint32_t nClientID, FrameList& frameList, size_t maxCount, int32_t nWaitForNewDataTimeOutMsec);
+	int32_t GetBatch(uint32_t nClientID, FrameViewList& viewList, size_t maxCount, int32_t nWaitForNewDataTimeOutMsec);
+
+	// Threads that run Subscribe callbacks and resume GetAsync. Without one set, a pool with
+	// a thread per hardware thread is created on first use. Several splitters may share one.
+	void SetExecutor(const ExecutorPtr& executor);
+	ExecutorPtr GetExecutor();
+
+	// Delivers the client's frames to callback on the executor instead of a thread blocked in Get:
+	// in put order, one call at a time per client. The subscription ends with a final
+	// Error::NoClientFound call when the client is removed or the splitter is closed.
+	// ClientRemove, Close and the destructor return only after that call has returned, so
+	// whatever the callback uses may go away afterwards. A callback may remove its own client;
+	// the final call then follows once it returns. Called from a callback for another client
+	// whose delivery is running, they do not wait for it.
+	// A client takes one subscription; Get calls on it compete for the frames.
+	bool Subscribe(uint32_t clientID, DataCallback callback);
+
+#if defined(__cpp_impl_coroutine)
+	// co_await splitter->GetAsync(id, data) - Get without a timeout that suspends the coroutine
+	// instead of blocking. data must outlive the co_await.
+	GetAwaiter GetAsync(uint32_t clientID, DataPtr& data);
+#endif
 
 	int32_t Flush();
 	int32_t Close();
@@ -52,48 +405,232 @@ private:
 	ISplitter& operator=(const ISplitter& other) = delete;		
 
 	size_t GetClientCountImpl() const;
+	int32_t PutImpl(const DataPtr& data, FrameTagsPtr tags, const std::chrono::steady_clock::time_point* pDeadline);
+
+	// Deadline of a millisecond timeout, nullptr for -1 (infinite).
+	static const std::chrono::steady_clock::time_point* ToDeadline(int32_t timeOutMsec, std::chrono::steady_clock::time_point& deadline);
+
+	template <class Rep, class Period>
+	static std::chrono::steady_clock::time_point DeadlineAfter(const std::chrono::duration<Rep, Period>& timeout)
+	{
+		return std::chrono::steady_clock::now() + std::chrono::ceil<std::chrono::steady_clock::duration>(timeout);
+	}
+	std::shared_ptr<DataClient> ClientAddImpl(const ClientOptions& options);
+	std::shared_ptr<DataClient> GroupMemberAdd(const ClientOptions& options);
+	size_t GetBufferPoolSize() const;
+	bool RetainBytes(QueuedData& item, const std::chrono::steady_clock::time_point* pDeadline);
+	static DataPtr RunTransform(const FrameTransform& transform, const Frame& frame);
+	static void RunTransform(TransformTask& task);
+
+	static void Deliver(const std::shared_ptr<DataClient>& client, const ExecutorPtr& executor);
 
 	class DataClient final {
 	public:
-		explicit DataClient(size_t maxBuffers);
+		DataClient(uint32_t clientId, Engine engine, const ClientOptions& options, const SpillFilePtr& spill);
+		DataClient(uint32_t clientId, const RingPtr& ring, const ClientOptions& options);
+		DataClient(uint32_t clientId, const std::shared_ptr<DataClient>& group, const ClientOptions& options);
 		~DataClient();
 
-	    static std::shared_ptr<DataClient> Create(size_t maxBuffers);		
+	    static std::shared_ptr<DataClient> Create(uint32_t clientId, Engine engine, const ClientOptions& options, const SpillFilePtr& spill = SpillFilePtr());		
+		static std::shared_ptr<DataClient> Create(uint32_t clientId, const RingPtr& ring, const ClientOptions& options);
+		static std::shared_ptr<DataClient> Create(uint32_t clientId, const std::shared_ptr<DataClient>& group, const ClientOptions& options);
 
 	public:
 		uint32_t GetClientId() const;
+		size_t GetMaxBuffers() const;
+		int32_t GetPriority() const;
+		const FrameTransformPtr& GetTransform() const;
 		size_t GetDroppedCount() const;
 		size_t GetLatencyCount() const;
+		size_t GetRetainedBytes() const;
+		void GetStats(ClientStats* pStats) const;
+		bool IsRemoved() const;
+
+		int32_t PutData(const QueuedData& data, int32_t nWaitForBuffersFreeTimeOutMsec);
+		int32_t PutDataUntil(const QueuedData& data, const std::chrono::steady_clock::time_point& deadline);
+		bool TryPutData(const QueuedData& data);
+		size_t TryPutDataBatch(const QueuedData* data, size_t count);
+		size_t PutDataBatch(const QueuedData* data, size_t count, const std::chrono::steady_clock::time_point* pDeadline);
+		int32_t GetData(DataPtr& data, const std::chrono::steady_clock::time_point* pDeadline);
+		int32_t GetData(Frame& frame, const std::chrono::steady_clock::time_point* pDeadline);
+		int32_t GetData(FrameView& view, const std::chrono::steady_clock::time_point* pDeadline);
+		int32_t TryGetData(DataPtr& data);
+		int32_t TryGetData(Frame& frame);
+		int32_t TryGetData(FrameView& view);
+		int32_t GetDataBatch(DataPtrList& dataList, size_t maxCount, const std::chrono::steady_clock::time_point* pDeadline);
+		int32_t GetDataBatch(FrameList& frameList, size_t maxCount, const std::chrono::steady_clock::time_point* pDeadline);
+		int32_t GetDataBatch(FrameViewList& viewList, size_t maxCount, const std::chrono::steady_clock::time_point* pDeadline);
+		void AddDropped(size_t count);
+
+		// Runs waiter once, as soon as the client has a frame or is removed (right away if it
+		// already does), on the thread that put the frame. Waiters must not block.
+		void AddWaiter(std::function<void()> waiter);
+		void NotifyWaiters();
+		bool HasData() const;
+
+		// Subscribe: the callback runs under the deliver mutex, so ending the subscription
+		// waits for a delivery in progress and makes the final call exactly once.
+		bool SetSubscribed(DataCallback callback);
+		int32_t DeliverData(size_t maxCount);
+		void EndSubscription();
+		int GetEventFd();
+
+		// PutOrder::Sequenced: Put delivers frame sequence to the client only after sequence - 1.
+		void WaitPutTurn(uint64_t sequence);
+		void PassPutTurn(uint64_t sequence);
+		// Sequences below the first one went to the clients present before this one joined.
+		bool TakesSequence(uint64_t sequence) const;
+		void SetFirstSequence(uint64_t sequence);
+
+		// Consumer group: the group client a member takes its frames from (nullptr for others),
+		// and the members of a group client. Changed under the splitter's client list mutex.
+		const std::shared_ptr<DataClient>& GetGroup() const;
+		void AddMember(const std::shared_ptr<DataClient>& member);
+		void RemoveMember(const std::shared_ptr<DataClient>& member);
+		std::vector<std::shared_ptr<DataClient>> TakeMembers();
+
+		void FlushData(uint64_t flushEpoch);
+		void Disconnect();
+	private:
+		using MemberList = std::vector<std::shared_ptr<DataClient>>;
 
-		int32_t PutData(const DataPtr& data, int32_t nWaitForBuffersFreeTimeOutMsec);
-		int32_t GetData(DataPtr& data, int32_t nWaitForNewDataTimeOutMsec);
+		DataClient& GetQueueOwner();
 
-		void FlushData();
-	private:
-		static uint32_t GenerateId();
+		static QueuePtr CreateQueue(size_t maxBuffers, size_t maxBytes, Engine engine);
+
+		const QueuePtr& GetQueue() const;
+		bool TryPopData(QueuedData& item);
+		bool DiscardStale(QueuedData& item);
+
+		size_t PutDataNoWait(const QueuedData* data, size_t count);
+		size_t PutDataSpill(const QueuedData* data, size_t count);
+		void RefillFromSpill();
+		size_t GetSpilledCount() const;
+
+		void ArmEvent();
+		void ResetEvent();
+		void ResetEventIfEmpty();
+
+		void CallSubscriber(int32_t errorId, const DataPtr& data);
+		void EndSubscriptionLocked();
+
+		// The Get variants above wrap these, they only differ in what they return of the items.
+		int32_t GetItem(QueuedData& item, const std::chrono::steady_clock::time_point* pDeadline);
+		int32_t TryGetItem(QueuedData& item);
+		int32_t GetItemBatch(QueuedDataList& items, size_t maxCount, const std::chrono::steady_clock::time_point* pDeadline);
+
+		bool PopData(QueuedData& item, const std::chrono::steady_clock::time_point* pDeadline, LatencyHistogram& getWait);
+		void RecordDelivery(const QueuedData& item, std::chrono::steady_clock::time_point now);
+		void ApplyTransform(QueuedData& item) const;
+		static Frame ToFrame(QueuedData&& item);
+		FrameView ToView(QueuedData&& item) const;
 
 		DataClient(const DataClient& other) = delete;
 		DataClient& operator=(const DataClient& other) = delete;
 
 	private:
-		const uint32_t mClientId = 0;
+		static constexpr size_t CacheLineSize = 64;
 
+		// Set up once, read by both sides.
+		const uint32_t mClientId = 0;
+		const Engine mEngine;
+		const OverflowPolicy mOverflowPolicy;
+		const size_t mMaxBuffers;
+		const size_t mMaxBytes;
+		const int32_t mPriority;
+		const FrameSlice mSlice;
+		const FrameTransformPtr mTransform;
+		const QueuePtr mDataQueue;
+		RingPtr mRing;
+		Ring::reader_ptr mRingReader;
+		const SpillFilePtr mSpill;
+		const std::shared_ptr<DataClient> mGroup;
+		std::atomic_bool mRemoved{ false };
+
+		// Written by Put. The producer and consumer regions start on cache lines of their own,
+		// so the two threads of a client do not invalidate each other's lines on every frame.
+		alignas(CacheLineSize) std::atomic<size_t> mDropped{ 0 };
+		static constexpr uint64_t NoSequence = UINT64_MAX;
+		std::atomic<uint64_t> mFirstSequence{ NoSequence };
+		LatencyHistogram mPutWait;
+		turnstile mPutTurn;
+
+		// Written by Get.
+		alignas(CacheLineSize) LatencyHistogram mEndToEnd;
+		LatencyHistogram mGetWait;
+		std::atomic<uint64_t> mFlushEpoch{ 0 };
+
+		// Waiters and the eventfd, touched by Put only while a consumer waits on them.
+		alignas(CacheLineSize) std::atomic_bool mHasWaiters{ false };
+		std::atomic_bool mEventArmed{ false };
+		std::atomic<int> mEventFd{ -1 };
+		bool mEventFdTaken = false;
+		std::mutex mWaitersMutex;
+		std::vector<std::function<void()>> mWaiters;
+		// A frame for the group may be taken by any member, so Put wakes their waiters too.
+		std::atomic_bool mHasMembers{ false };
+		std::shared_ptr<const MemberList> mMembers = std::make_shared<const MemberList>();
+		// Guards creating and handing out the eventfd.
 		mutable std::mutex mClientInfoMutex;
-		size_t mDropped = 0;		
+		// The subscription, see SetSubscribed.
+		std::mutex mDeliverMutex;
+		DataCallback mCallback;
+		bool mSubscriptionEnded = false;
 
-		QueuePtr mDataQueue;
+		// Guards the spill file and, while it holds frames, keeps Put out of the queue.
+		alignas(CacheLineSize) mutable std::mutex mSpillMutex;
 
 		static const std::string TAG;
 	};
 
 	using DataClientPtr = std::shared_ptr<DataClient>;
 
+	// Client ID = (generation << ClientSlotBits) | slot, so lookup by ID is a single
+	// table access and a stale ID of a removed client never matches the new occupant.
+	// The slot bits are what limits a splitter to MaxClients clients.
+	static constexpr uint32_t ClientSlotBits = 16;
+	static constexpr uint32_t ClientSlotMask = (1u << ClientSlotBits) - 1;
+	static constexpr uint32_t ClientGenerationMax = UINT32_MAX >> ClientSlotBits;
+	static_assert(MaxClients == ClientSlotMask + 1, "a client slot for every client");
+
+	struct ClientSlot {
+		DataClientPtr client;
+		uint32_t generation = 0;
+	};
+
+	DataClientPtr FindClient(uint32_t clientID) const;
+	uint32_t TakeClientSlot();
+	void ReleaseClient(const DataClientPtr& client, std::vector<DataClientPtr>& released);
+
+	using DataClientList = std::vector<DataClientPtr>;
+	using DataClientListPtr = std::shared_ptr<const DataClientList>;
+
+	DataClientListPtr GetClientList() const;
+	void SetClientList(DataClientListPtr clients);
+	void SkipSequences(const DataClientList& clients, uint64_t firstSequence, uint64_t lastSequence);
+	void StartTransforms(const DataClientList& clients, QueuedData* items, size_t count);
+
 private:
 	const size_t mMaxBuffers;
 	size_t mMaxClients;
+	const Engine mEngine;
+	const PutOrder mPutOrder;
+	RingPtr mRing;
+	turnstile mRingPutTurn;
+	std::atomic<uint64_t> mNextSequence{ 0 };
+	std::atomic<uint64_t> mFlushEpoch{ 0 };
+	BufferPoolPtr mBufferPool;
+	std::shared_ptr<byte_budget> mByteBudget;
+
+	std::mutex mExecutorMutex;
+	ExecutorPtr mExecutor;
 	
-	mutable std::shared_mutex mDataClientListMutex;
-	std::deque<DataClientPtr> mDataClientList;
+	// Immutable list sorted by priority, replaced as a whole under mClientListMutex.
+	std::mutex mClientListMutex;
+	DataClientListPtr mClientList = std::make_shared<DataClientList>();
+
+	std::vector<ClientSlot> mClientSlots;
+	std::vector<uint32_t> mFreeSlots;
 
 	static const std::string TAG;
 };
@@ -0,0 +1,104 @@
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+const std::string LatencyHistogram::TAG = "LatencyHistogram: ";
+
+LatencyHistogram::LatencyHistogram()
+{
+	Reset();
+}
+
+void LatencyHistogram::Record(std::chrono::nanoseconds value)
+{
+	const auto ns = static_cast<uint64_t>(std::max<int64_t>(value.count(), 0));
+
+	mBuckets[GetBucketIndex(ns)].fetch_add(1, memory_order_relaxed);
+
+	auto max = mMax.load(memory_order_relaxed);
+	while (ns > max && !mMax.compare_exchange_weak(max, ns, memory_order_relaxed)) {}
+}
+
+void LatencyHistogram::Reset()
+{
+	for (auto& bucket : mBuckets)
+		bucket.store(0, memory_order_relaxed);
+
+	mMax.store(0, memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::GetCount() const
+{
+	uint64_t count = 0;
+	for (const auto& bucket : mBuckets)
+		count += bucket.load(memory_order_relaxed);
+
+	return count;
+}
+
+std::chrono::nanoseconds LatencyHistogram::GetMax() const
+{
+	return std::chrono::nanoseconds(mMax.load(memory_order_relaxed));
+}
+
+std::chrono::nanoseconds LatencyHistogram::GetPercentile(double fraction) const
+{
+	std::array<uint64_t, BucketCount> counts;
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < BucketCount; i++) {
+		counts[i] = mBuckets[i].load(memory_order_relaxed);
+		total += counts[i];
+	}
+
+	if (!total)
+		return std::chrono::nanoseconds(0);
+
+	fraction = std::min(std::max(fraction, 0.0), 1.0);
+	const auto rank = std::max<uint64_t>(static_cast<uint64_t>(std::ceil(fraction * total)), 1);
+
+	uint64_t seen = 0;
+	for (uint32_t i = 0; i < BucketCount; i++) {
+		seen += counts[i];
+		if (seen >= rank) {
+			// Middle of the bucket, but never above the largest value actually recorded.
+			const auto width = i + 1 < BucketCount ? GetBucketValue(i + 1) - GetBucketValue(i) : 1;
+			const auto value = std::min(GetBucketValue(i) + width / 2, static_cast<uint64_t>(GetMax().count()));
+			return std::chrono::nanoseconds(value);
+		}
+	}
+
+	return GetMax();
+}
+
+uint32_t LatencyHistogram::GetBucketIndex(uint64_t value)
+{
+	if (value < LinearCount)
+		return static_cast<uint32_t>(value);
+
+	value = std::min<uint64_t>(value, (uint64_t(1) << MaxValueBits) - 1);
+
+	uint32_t highestBit = 0;
+	for (uint32_t step = 32; step; step >>= 1) {
+		if (value >> (highestBit + step))
+			highestBit += step;
+	}
+
+	const auto shift = highestBit - SubBucketBits;
+	const auto subBucket = static_cast<uint32_t>(value >> shift) - SubBucketCount;
+
+	return LinearCount + (shift - 1) * SubBucketCount + subBucket;
+}
+
+uint64_t LatencyHistogram::GetBucketValue(uint32_t index)
+{
+	if (index < LinearCount)
+		return index;
+
+	const auto shift = (index - LinearCount) / SubBucketCount + 1;
+	const auto subBucket = (index - LinearCount) % SubBucketCount + SubBucketCount;
+
+	return uint64_t(subBucket) << shift;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// HDR-style log-linear histogram of durations. Values below 32 ns are counted exactly,
+// larger ones by their highest bit and the next SubBucketBits bits, so a bucket is never
+// wider than 1/16 of the values it holds. Values from 2^MaxValueBits ns (about 18 minutes)
+// up land in the last bucket. Record() is lock-free and may run concurrently with the getters.
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+
+	void Record(std::chrono::nanoseconds value);
+	void Reset();
+
+	uint64_t GetCount() const;
+	std::chrono::nanoseconds GetMax() const;
+
+	// Value that the given fraction (0..1) of the samples do not exceed, 0 if there are no samples.
+	std::chrono::nanoseconds GetPercentile(double fraction) const;
+
+private:
+	LatencyHistogram(const LatencyHistogram& other) = delete;
+	LatencyHistogram& operator=(const LatencyHistogram& other) = delete;
+
+	static constexpr uint32_t SubBucketBits = 4;
+	static constexpr uint32_t SubBucketCount = 1u << SubBucketBits;
+	static constexpr uint32_t LinearCount = SubBucketCount * 2;
+	static constexpr uint32_t MaxValueBits = 40;
+	static constexpr uint32_t BucketCount = LinearCount + (MaxValueBits - SubBucketBits - 1) * SubBucketCount;
+
+	static uint32_t GetBucketIndex(uint64_t value);
+	static uint64_t GetBucketValue(uint32_t index);
+
+private:
+	std::array<std::atomic<uint64_t>, BucketCount> mBuckets;
+	std::atomic<uint64_t> mMax{ 0 };
+
+	static const std::string TAG;
+};
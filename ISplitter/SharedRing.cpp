@@ -0,0 +1,584 @@
+#include "SharedRing.h"
+
+#include <atomic>
+#include <cstring>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+const std::string SharedRing::TAG = "SharedRing: ";
+
+#if defined(__linux__)
+
+// Client slots and ring slots follow the header in the segment. Frame index i (0-based) lives
+// in ring slot i % SlotCount and is handed out as sequence i + 1, so sequence 0 marks a slot
+// that holds no frame (yet). With maxBuffers + 1 slots the frame a client holds since its last
+// Get is never reused while the client's unread frames stay within maxBuffers.
+struct SharedRing::Segment {
+	static constexpr uint32_t Magic = 0x53524E47;	// "SRNG"
+	static constexpr uint32_t Version = 2;
+
+	struct Client {
+		uint32_t generation;
+		uint32_t attached;
+		uint64_t cursor;	// index of the next frame to read
+		uint64_t dropped;
+	};
+
+	struct Slot {
+		std::atomic<uint64_t> sequence;
+		uint64_t size;
+		int64_t putTimeNs;
+	};
+
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared ring needs address-free atomics");
+
+	std::atomic<uint32_t> magic;
+	uint32_t version;
+	uint64_t maxBuffers;
+	uint64_t maxClients;
+	uint64_t maxFrameSize;
+	uint64_t slotCount;
+	uint64_t slotStride;
+
+	pthread_mutex_t mutex;
+	// Held by a Put from reserving its slot until the frame is published, in whichever
+	// process it runs; the ring has one writer slot.
+	pthread_mutex_t putMutex;
+	pthread_cond_t newData;
+	pthread_cond_t freeSlot;
+
+	uint64_t head;	// index of the next frame to put
+	uint32_t closed;
+
+	static size_t GetSlotStride(size_t maxFrameSize)
+	{
+		return (sizeof(Slot) + maxFrameSize + 63) / 64 * 64;
+	}
+
+	static size_t GetClientsOffset()
+	{
+		return (sizeof(Segment) + 63) / 64 * 64;
+	}
+
+	static size_t GetSlotsOffset(size_t maxClients)
+	{
+		return (GetClientsOffset() + maxClients * sizeof(Client) + 63) / 64 * 64;
+	}
+
+	static size_t GetSize(size_t maxBuffers, size_t maxClients, size_t maxFrameSize)
+	{
+		return GetSlotsOffset(maxClients) + (maxBuffers + 1) * GetSlotStride(maxFrameSize);
+	}
+
+	Client* GetClients()
+	{
+		return reinterpret_cast<Client*>(reinterpret_cast<uint8_t*>(this) + GetClientsOffset());
+	}
+
+	Slot* GetSlot(uint64_t index)
+	{
+		return reinterpret_cast<Slot*>(reinterpret_cast<uint8_t*>(this) + GetSlotsOffset(maxClients)
+			+ (index % slotCount) * slotStride);
+	}
+
+	uint8_t* GetSlotData(uint64_t index)
+	{
+		return reinterpret_cast<uint8_t*>(GetSlot(index) + 1);
+	}
+
+	// Client by ID, nullptr if the ID is stale or out of range. Expects mutex to be held.
+	Client* FindClient(uint32_t clientID)
+	{
+		const auto slot = clientID & ClientSlotMask;
+		if (slot >= maxClients)
+			return nullptr;
+
+		auto* client = GetClients() + slot;
+		if (!client->attached || client->generation != (clientID >> ClientSlotBits))
+			return nullptr;
+
+		return client;
+	}
+
+	bool HasLagging()
+	{
+		auto* clients = GetClients();
+		for (uint64_t i = 0; i < maxClients; i++) {
+			if (clients[i].attached && head - clients[i].cursor >= maxBuffers)
+				return true;
+		}
+		return false;
+	}
+
+	// Same client ID layout as ISplitter: (generation << ClientSlotBits) | slot.
+	static constexpr uint32_t ClientSlotBits = 16;
+	static constexpr uint32_t ClientSlotMask = (1u << ClientSlotBits) - 1;
+};
+
+namespace {
+
+	std::string GetShmName(const std::string& name)
+	{
+		return name.empty() || name[0] != '/' ? "/" + name : name;
+	}
+
+	// The CLOCK_REALTIME time of a CLOCK_MONOTONIC deadline, for pthread_mutex_timedlock.
+	timespec ToRealtime(const timespec& deadline)
+	{
+		timespec now{};
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		timespec realtime{};
+		clock_gettime(CLOCK_REALTIME, &realtime);
+
+		realtime.tv_sec += deadline.tv_sec - now.tv_sec;
+		realtime.tv_nsec += deadline.tv_nsec - now.tv_nsec;
+		if (realtime.tv_nsec < 0) {
+			realtime.tv_sec--;
+			realtime.tv_nsec += 1000000000;
+		}
+		else if (realtime.tv_nsec >= 1000000000) {
+			realtime.tv_sec++;
+			realtime.tv_nsec -= 1000000000;
+		}
+
+		return realtime;
+	}
+
+	// A process that died holding a segment mutex leaves the ring state consistent (every update
+	// is a few stores), so the lock is just marked consistent and taken over. A Put that died
+	// holding putMutex had not moved head yet; the next Put rewrites the same slot.
+	class SegmentLock final {
+	public:
+		// pDeadline - absolute CLOCK_MONOTONIC time to give up at, nullptr - infinite.
+		explicit SegmentLock(pthread_mutex_t* pMutex, const timespec* pDeadline = nullptr)
+			: mMutex(pMutex)
+		{
+			const auto realtimeDeadline = pDeadline ? ToRealtime(*pDeadline) : timespec{};
+			const auto result = pDeadline
+				? pthread_mutex_timedlock(mMutex, &realtimeDeadline)
+				: pthread_mutex_lock(mMutex);
+
+			if (result == EOWNERDEAD)
+				pthread_mutex_consistent(mMutex);
+
+			mLocked = result == 0 || result == EOWNERDEAD;
+		}
+
+		~SegmentLock()
+		{
+			if (mLocked)
+				pthread_mutex_unlock(mMutex);
+		}
+
+		// False if the deadline passed first.
+		bool IsLocked() const { return mLocked; }
+
+		// Waits for a signal until the deadline (nullptr - infinite), false on timeout.
+		bool Wait(pthread_cond_t* pCondition, const timespec* pDeadline)
+		{
+			const auto result = pDeadline
+				? pthread_cond_timedwait(pCondition, mMutex, pDeadline)
+				: pthread_cond_wait(pCondition, mMutex);
+
+			if (result == EOWNERDEAD)
+				pthread_mutex_consistent(mMutex);
+
+			return result != ETIMEDOUT;
+		}
+
+	private:
+		SegmentLock(const SegmentLock& other) = delete;
+		SegmentLock& operator=(const SegmentLock& other) = delete;
+
+		pthread_mutex_t* const mMutex;
+		bool mLocked = false;
+	};
+
+	// Absolute CLOCK_MONOTONIC deadline for the condition variables of the segment.
+	timespec GetDeadline(int32_t timeoutMsec)
+	{
+		timespec deadline{};
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+		deadline.tv_sec += timeoutMsec / 1000;
+		deadline.tv_nsec += static_cast<long>(timeoutMsec % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+
+		return deadline;
+	}
+}
+
+SharedRing::SharedRing(const std::string& name, Segment* pSegment, size_t size, bool owner)
+	: mName(name)
+	, mSegment(pSegment)
+	, mSize(size)
+	, mOwner(owner)
+{
+}
+
+SharedRing::~SharedRing()
+{
+	if (mOwner) {
+		Close();
+		shm_unlink(mName.c_str());
+	}
+
+	munmap(mSegment, mSize);
+}
+
+SharedRingPtr SharedRing::Create(const std::string& name, size_t maxBuffers, size_t maxClients, size_t maxFrameSize)
+{
+	if (!maxBuffers || !maxClients || maxClients > Segment::ClientSlotMask + 1)
+		return SharedRingPtr();
+
+	const auto shmName = GetShmName(name);
+	const auto size = Segment::GetSize(maxBuffers, maxClients, maxFrameSize);
+
+	const int fd = shm_open(shmName.c_str(), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+	if (fd < 0)
+		return SharedRingPtr();
+
+	if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+		close(fd);
+		shm_unlink(shmName.c_str());
+		return SharedRingPtr();
+	}
+
+	auto ring = Map(shmName, fd, size, true);
+	if (!ring) {
+		shm_unlink(shmName.c_str());
+		return ring;
+	}
+
+	// The new segment is zero filled: no clients, no frames, every slot sequence 0.
+	auto* segment = ring->mSegment;
+	segment->version = Segment::Version;
+	segment->maxBuffers = maxBuffers;
+	segment->maxClients = maxClients;
+	segment->maxFrameSize = maxFrameSize;
+	segment->slotCount = maxBuffers + 1;
+	segment->slotStride = Segment::GetSlotStride(maxFrameSize);
+
+	pthread_mutexattr_t mutexAttr;
+	pthread_mutexattr_init(&mutexAttr);
+	pthread_mutexattr_setpshared(&mutexAttr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&mutexAttr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&segment->mutex, &mutexAttr);
+	pthread_mutex_init(&segment->putMutex, &mutexAttr);
+	pthread_mutexattr_destroy(&mutexAttr);
+
+	pthread_condattr_t condAttr;
+	pthread_condattr_init(&condAttr);
+	pthread_condattr_setpshared(&condAttr, PTHREAD_PROCESS_SHARED);
+	pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+	pthread_cond_init(&segment->newData, &condAttr);
+	pthread_cond_init(&segment->freeSlot, &condAttr);
+	pthread_condattr_destroy(&condAttr);
+
+	segment->magic.store(Segment::Magic, memory_order_release);
+
+	return ring;
+}
+
+SharedRingPtr SharedRing::Open(const std::string& name)
+{
+	const auto shmName = GetShmName(name);
+
+	const int fd = shm_open(shmName.c_str(), O_RDWR, 0);
+	if (fd < 0)
+		return SharedRingPtr();
+
+	struct stat info {};
+	if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(Segment)) {
+		close(fd);
+		return SharedRingPtr();
+	}
+
+	auto ring = Map(shmName, fd, static_cast<size_t>(info.st_size), false);
+	if (!ring)
+		return ring;
+
+	auto* segment = ring->mSegment;
+	if (segment->magic.load(memory_order_acquire) != Segment::Magic || segment->version != Segment::Version
+		|| ring->mSize < Segment::GetSize(segment->maxBuffers, segment->maxClients, segment->maxFrameSize))
+		return SharedRingPtr();
+
+	return ring;
+}
+
+bool SharedRing::Unlink(const std::string& name)
+{
+	return shm_unlink(GetShmName(name).c_str()) == 0;
+}
+
+SharedRingPtr SharedRing::Map(const std::string& name, int fd, size_t size, bool owner)
+{
+	void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (address == MAP_FAILED)
+		return SharedRingPtr();
+
+	return SharedRingPtr(new SharedRing(name, static_cast<Segment*>(address), size, owner));
+}
+
+bool SharedRing::InfoGet(size_t* pMaxBuffers, size_t* pMaxClients, size_t* pMaxFrameSize) const
+{
+	if (pMaxBuffers)
+		*pMaxBuffers = mSegment->maxBuffers;
+	if (pMaxClients)
+		*pMaxClients = mSegment->maxClients;
+	if (pMaxFrameSize)
+		*pMaxFrameSize = mSegment->maxFrameSize;
+
+	return true;
+}
+
+bool SharedRing::ClientAdd(uint32_t* pClientID)
+{
+	if (!pClientID)
+		return false;
+
+	SegmentLock lock(&mSegment->mutex);
+	if (mSegment->closed)
+		return false;
+
+	auto* clients = mSegment->GetClients();
+	for (uint32_t slot = 0; slot < mSegment->maxClients; slot++) {
+		auto& client = clients[slot];
+		if (client.attached)
+			continue;
+
+		// Generation 0 is skipped so that no valid ID is 0.
+		client.generation = (client.generation + 1) & (UINT32_MAX >> Segment::ClientSlotBits);
+		if (!client.generation)
+			client.generation = 1;
+
+		client.attached = 1;
+		client.cursor = mSegment->head;
+		client.dropped = 0;
+
+		*pClientID = (client.generation << Segment::ClientSlotBits) | slot;
+		return true;
+	}
+
+	return false;
+}
+
+bool SharedRing::ClientRemove(uint32_t clientID)
+{
+	SegmentLock lock(&mSegment->mutex);
+
+	auto* client = mSegment->FindClient(clientID);
+	if (!client)
+		return false;
+
+	client->attached = 0;
+
+	pthread_cond_broadcast(&mSegment->newData);
+	pthread_cond_broadcast(&mSegment->freeSlot);
+
+	return true;
+}
+
+bool SharedRing::ClientGetById(uint32_t clientID, size_t* pLatency, size_t* pDropped) const
+{
+	SegmentLock lock(&mSegment->mutex);
+
+	auto* client = mSegment->FindClient(clientID);
+	if (!client)
+		return false;
+
+	if (pLatency)
+		*pLatency = static_cast<size_t>(mSegment->head - client->cursor);
+	if (pDropped)
+		*pDropped = static_cast<size_t>(client->dropped);
+
+	return true;
+}
+
+int32_t SharedRing::Put(const DataPtr& data, int32_t nWaitForBuffersFreeTimeOutMsec)
+{
+	const size_t size = data ? data->size() : 0;
+	if (size > mSegment->maxFrameSize)
+		return static_cast<int32_t>(Error::FrameTooLarge);
+
+	const auto putTime = chrono::steady_clock::now();
+	const auto deadline = GetDeadline(std::max(nWaitForBuffersFreeTimeOutMsec, 0));
+	const auto* pDeadline = nWaitForBuffersFreeTimeOutMsec == -1 ? nullptr : &deadline;
+
+	// A Put of another process may hold the writer slot while it waits for slow clients; past the
+	// deadline the frame is dropped for every client, as if they all had lagged.
+	SegmentLock putLock(&mSegment->putMutex, pDeadline);
+	if (!putLock.IsLocked()) {
+		SegmentLock lock(&mSegment->mutex);
+		if (mSegment->closed)
+			return static_cast<int32_t>(Error::DataFlushed);
+
+		bool hasClients = false;
+		auto* clients = mSegment->GetClients();
+		for (uint64_t i = 0; i < mSegment->maxClients; i++) {
+			if (clients[i].attached) {
+				clients[i].dropped++;
+				hasClients = true;
+			}
+		}
+
+		return static_cast<int32_t>(hasClients ? Error::DataDropped : Error::NoClients);
+	}
+
+	size_t dropped = 0;
+	uint64_t index = 0;
+	{
+		SegmentLock lock(&mSegment->mutex);
+
+		bool hasClients = false;
+		auto* clients = mSegment->GetClients();
+		for (uint64_t i = 0; i < mSegment->maxClients; i++)
+			hasClients |= clients[i].attached != 0;
+
+		if (!hasClients)
+			return static_cast<int32_t>(Error::NoClients);
+
+		while (!mSegment->closed && mSegment->HasLagging()) {
+			if (!lock.Wait(&mSegment->freeSlot, pDeadline))
+				break;
+		}
+
+		if (mSegment->closed)
+			return static_cast<int32_t>(Error::DataFlushed);
+
+		index = mSegment->head;
+		for (uint64_t i = 0; i < mSegment->maxClients; i++) {
+			auto& client = clients[i];
+			if (client.attached && index - client.cursor >= mSegment->maxBuffers) {
+				client.cursor++;
+				client.dropped++;
+				dropped++;
+			}
+		}
+
+		// Only a client that was overtaken can still hold the frame in this slot; the zero
+		// sequence tells it so while the slot is rewritten.
+		mSegment->GetSlot(index)->sequence.store(0, memory_order_release);
+	}
+
+	// No client reads frame index before head moves past it, so the copy runs unlocked.
+	auto* slot = mSegment->GetSlot(index);
+	slot->size = size;
+	slot->putTimeNs = chrono::duration_cast<chrono::nanoseconds>(putTime.time_since_epoch()).count();
+	if (size)
+		memcpy(mSegment->GetSlotData(index), data->data(), size);
+
+	{
+		SegmentLock lock(&mSegment->mutex);
+
+		slot->sequence.store(index + 1, memory_order_release);
+		mSegment->head = index + 1;
+
+		pthread_cond_broadcast(&mSegment->newData);
+	}
+
+	return dropped ? static_cast<int32_t>(Error::DataDropped) : 0;
+}
+
+int32_t SharedRing::Get(uint32_t nClientID, Frame& frame, int32_t nWaitForNewDataTimeOutMsec)
+{
+	const auto deadline = GetDeadline(std::max(nWaitForNewDataTimeOutMsec, 0));
+	const auto* pDeadline = nWaitForNewDataTimeOutMsec == -1 ? nullptr : &deadline;
+
+	SegmentLock lock(&mSegment->mutex);
+
+	auto* client = mSegment->FindClient(nClientID);
+	while (client && !mSegment->closed && client->cursor == mSegment->head) {
+		if (!lock.Wait(&mSegment->newData, pDeadline))
+			break;
+
+		client = mSegment->FindClient(nClientID);
+	}
+
+	if (mSegment->closed)
+		return static_cast<int32_t>(Error::DataFlushed);
+
+	if (!client)
+		return static_cast<int32_t>(Error::NoClientFound);
+
+	if (client->cursor == mSegment->head)
+		return static_cast<int32_t>(Error::NoNewData);
+
+	const auto index = client->cursor++;
+	const auto* slot = mSegment->GetSlot(index);
+
+	frame.sequence = index + 1;
+	frame.putTime = chrono::steady_clock::time_point(chrono::duration_cast<chrono::steady_clock::duration>(
+		chrono::nanoseconds(slot->putTimeNs)));
+	frame.size = static_cast<size_t>(slot->size);
+	frame.data = mSegment->GetSlotData(index);
+
+	pthread_cond_broadcast(&mSegment->freeSlot);
+
+	return 0;
+}
+
+bool SharedRing::IsValid(const Frame& frame) const
+{
+	if (!frame.sequence)
+		return false;
+
+	return mSegment->GetSlot(frame.sequence - 1)->sequence.load(memory_order_acquire) == frame.sequence;
+}
+
+int32_t SharedRing::Close()
+{
+	SegmentLock lock(&mSegment->mutex);
+
+	mSegment->closed = 1;
+
+	pthread_cond_broadcast(&mSegment->newData);
+	pthread_cond_broadcast(&mSegment->freeSlot);
+
+	return static_cast<int32_t>(Error::DataFlushed);
+}
+
+#else
+
+struct SharedRing::Segment {};
+
+SharedRing::SharedRing(const std::string& name, Segment* pSegment, size_t size, bool owner)
+	: mName(name)
+	, mSegment(pSegment)
+	, mSize(size)
+	, mOwner(owner)
+{
+}
+
+SharedRing::~SharedRing() {}
+
+SharedRingPtr SharedRing::Create(const std::string&, size_t, size_t, size_t) { return SharedRingPtr(); }
+SharedRingPtr SharedRing::Open(const std::string&) { return SharedRingPtr(); }
+bool SharedRing::Unlink(const std::string&) { return false; }
+SharedRingPtr SharedRing::Map(const std::string&, int, size_t, bool) { return SharedRingPtr(); }
+
+bool SharedRing::InfoGet(size_t*, size_t*, size_t*) const { return false; }
+bool SharedRing::ClientAdd(uint32_t*) { return false; }
+bool SharedRing::ClientRemove(uint32_t) { return false; }
+bool SharedRing::ClientGetById(uint32_t, size_t*, size_t*) const { return false; }
+int32_t SharedRing::Put(const DataPtr&, int32_t) { return static_cast<int32_t>(Error::NoClients); }
+int32_t SharedRing::Get(uint32_t, Frame&, int32_t) { return static_cast<int32_t>(Error::NoClientFound); }
+bool SharedRing::IsValid(const Frame&) const { return false; }
+int32_t SharedRing::Close() { return static_cast<int32_t>(Error::DataFlushed); }
+
+#endif
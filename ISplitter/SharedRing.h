@@ -0,0 +1,86 @@
+#pragma once
+
+#include "ISplitter.h"
+
+#include <memory>
+#include <string>
+#include <chrono>
+
+class SharedRing;
+
+using SharedRingPtr = std::shared_ptr<SharedRing>;
+
+// Splitter whose frame ring lives in a shared memory segment (shm_open), so clients in
+// other processes read the frames in place, without a copy per client.
+//
+// The producer process creates the ring by name; a client process opens the same name and
+// reads with a client ID that either side got from ClientAdd(). Put copies a frame into the
+// segment once. Latency and drop semantics are those of ISplitter::Get with the Ring engine:
+// Put waits up to its timeout for clients with maxBuffers unread frames, then drops their
+// oldest frame; Get waits for a new frame and returns the frames in put order.
+//
+// Get returns a descriptor pointing into the segment. The frame stays in place until the
+// next Get of the same client; only a Put that times out on this client may reuse the slot
+// earlier, which IsValid() detects. State is guarded by a robust process-shared mutex, so a
+// client process that dies while holding it does not stall the producer. Any process may
+// Put; Put calls take turns on a second robust mutex in the segment, and a Put that cannot
+// get its turn within its timeout drops its frame for every client.
+//
+// Only built on Linux; elsewhere Create() and Open() return nullptr.
+class SharedRing
+{
+public:
+	using Error = ISplitter::Error;
+
+	struct Frame {
+		uint64_t sequence = 0;
+		std::chrono::steady_clock::time_point putTime;
+		size_t size = 0;
+		const uint8_t* data = nullptr;
+	};
+
+	~SharedRing();
+
+	// Creates the segment and owns it: the name is unlinked when the ring is destroyed.
+	// Fails while a segment of that name exists, including one left by an owner that crashed;
+	// Unlink() removes it. maxFrameSize - largest frame Put accepts.
+	static SharedRingPtr Create(const std::string& name, size_t maxBuffers, size_t maxClients, size_t maxFrameSize);
+	// Maps the segment created under name by another process (or this one).
+	static SharedRingPtr Open(const std::string& name);
+	// Removes the name of a segment; processes that have it mapped keep using it.
+	static bool Unlink(const std::string& name);
+
+	bool InfoGet(size_t* pMaxBuffers, size_t* pMaxClients, size_t* pMaxFrameSize) const;
+
+	bool ClientAdd(uint32_t* pClientID);
+	bool ClientRemove(uint32_t clientID);
+	bool ClientGetById(uint32_t clientID, size_t* pLatency, size_t* pDropped) const;
+
+	// Error::DataDropped if some client lost a frame, Error::NoClients, or Error::FrameTooLarge.
+	int32_t Put(const DataPtr& data, int32_t nWaitForBuffersFreeTimeOutMsec);
+	int32_t Get(uint32_t nClientID, Frame& frame, int32_t nWaitForNewDataTimeOutMsec);
+
+	// False once the frame's slot was reused by a Put that dropped it.
+	bool IsValid(const Frame& frame) const;
+
+	// Wakes every waiting Put and Get; they, and any later call, return Error::DataFlushed.
+	int32_t Close();
+
+private:
+	struct Segment;
+
+	SharedRing(const std::string& name, Segment* pSegment, size_t size, bool owner);
+
+	SharedRing(const SharedRing& other) = delete;
+	SharedRing& operator=(const SharedRing& other) = delete;
+
+	static SharedRingPtr Map(const std::string& name, int fd, size_t size, bool owner);
+
+private:
+	const std::string mName;
+	Segment* const mSegment;
+	const size_t mSize;
+	const bool mOwner;
+
+	static const std::string TAG;
+};
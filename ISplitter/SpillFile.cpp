@@ -0,0 +1,349 @@
+#include "SpillFile.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#endif
+
+using namespace std;
+
+const std::string SpillFile::TAG = "SpillFile: ";
+
+// Records start at 8-byte boundaries. A record size of 0 where the next record should be
+// marks the unused end of the file; the log continues at offset 0.
+struct SpillFile::RecordHeader {
+	static constexpr uint32_t HasData = 1;
+	static constexpr uint32_t HasTags = 2;
+
+	uint64_t size;	// whole record, header included
+	uint32_t flags;
+	uint32_t reserved;
+	uint64_t dataSize;
+	uint64_t tagsSize;
+	uint64_t sequence;
+	uint64_t flushEpoch;
+	int64_t putTimeNs;
+};
+
+#if defined(__linux__)
+
+struct SpillFile::Storage {
+	int fd = -1;
+	uint8_t* data = nullptr;
+	size_t size = 0;
+	bool created = false;
+
+	~Storage()
+	{
+		if (data)
+			munmap(data, size);
+		if (fd >= 0)
+			close(fd);
+	}
+
+	bool Open(const std::string& path, size_t maxBytes)
+	{
+		// An existing file is never taken over, it may be the user's or another client's.
+		fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+		if (fd < 0)
+			return false;
+
+		created = true;
+
+		// Reserving the blocks up front turns a full disk into a failed ClientAdd
+		// instead of a SIGBUS on a write into the mapping.
+		if (posix_fallocate(fd, 0, static_cast<off_t>(maxBytes)) != 0)
+			return false;
+
+		auto* address = mmap(nullptr, maxBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (address == MAP_FAILED)
+			return false;
+
+		data = static_cast<uint8_t*>(address);
+		size = maxBytes;
+		return true;
+	}
+
+	void Write(size_t offset, const void* value, size_t count)
+	{
+		memcpy(data + offset, value, count);
+	}
+
+	void Read(size_t offset, void* value, size_t count) const
+	{
+		memcpy(value, data + offset, count);
+	}
+};
+
+#else
+
+struct SpillFile::Storage {
+	mutable std::fstream file;
+	bool created = false;
+
+	bool Open(const std::string& path, size_t maxBytes)
+	{
+		// "x" creates the file exclusively, like O_EXCL: an existing file is never taken over.
+		auto* createdFile = fopen(path.c_str(), "wbx");
+		if (!createdFile)
+			return false;
+
+		fclose(createdFile);
+		created = true;
+
+		file.open(path, ios::in | ios::out | ios::binary);
+		if (!file)
+			return false;
+
+		// Grows the file to its full size, so running out of disk shows at ClientAdd.
+		const char zero = 0;
+		file.seekp(static_cast<streamoff>(maxBytes) - 1);
+		file.write(&zero, 1);
+		file.flush();
+		return static_cast<bool>(file);
+	}
+
+	void Write(size_t offset, const void* value, size_t count)
+	{
+		file.seekp(static_cast<streamoff>(offset));
+		file.write(static_cast<const char*>(value), static_cast<streamsize>(count));
+	}
+
+	void Read(size_t offset, void* value, size_t count) const
+	{
+		file.seekg(static_cast<streamoff>(offset));
+		file.read(static_cast<char*>(value), static_cast<streamsize>(count));
+	}
+};
+
+#endif
+
+namespace {
+
+	size_t AlignRecord(size_t size)
+	{
+		return (size + 7) / 8 * 8;
+	}
+
+	// Tags as a count followed by length-prefixed keys and values.
+	std::vector<uint8_t> SerializeTags(const FrameTags& tags)
+	{
+		std::vector<uint8_t> buffer;
+		auto append = [&buffer](const void* value, size_t count) {
+			const auto* bytes = static_cast<const uint8_t*>(value);
+			buffer.insert(buffer.end(), bytes, bytes + count);
+		};
+		auto appendString = [&append](const std::string& value) {
+			const auto length = static_cast<uint32_t>(value.size());
+			append(&length, sizeof(length));
+			append(value.data(), value.size());
+		};
+
+		const auto count = static_cast<uint32_t>(tags.size());
+		append(&count, sizeof(count));
+		for (const auto& [key, value] : tags) {
+			appendString(key);
+			appendString(value);
+		}
+
+		return buffer;
+	}
+
+	FrameTags DeserializeTags(const std::vector<uint8_t>& buffer)
+	{
+		size_t offset = 0;
+		auto read = [&buffer, &offset](void* value, size_t count) {
+			memcpy(value, buffer.data() + offset, count);
+			offset += count;
+		};
+		auto readString = [&read, &buffer, &offset] {
+			uint32_t length = 0;
+			read(&length, sizeof(length));
+			std::string value(reinterpret_cast<const char*>(buffer.data()) + offset, length);
+			offset += length;
+			return value;
+		};
+
+		FrameTags tags;
+		uint32_t count = 0;
+		read(&count, sizeof(count));
+		for (uint32_t i = 0; i < count; i++) {
+			auto key = readString();
+			tags.emplace(std::move(key), readString());
+		}
+
+		return tags;
+	}
+
+} // namespace
+
+SpillFile::SpillFile(const std::string& path, std::unique_ptr<Storage> storage, size_t maxBytes)
+	: mPath(path)
+	, mStorage(std::move(storage))
+	, mMaxBytes(maxBytes)
+{
+}
+
+SpillFile::~SpillFile()
+{
+	std::remove(mPath.c_str());
+}
+
+SpillFilePtr SpillFile::Create(const std::string& path, size_t maxBytes)
+{
+	maxBytes = maxBytes / 8 * 8;
+	if (path.empty() || maxBytes < sizeof(RecordHeader))
+		return SpillFilePtr();
+
+	auto storage = std::make_unique<Storage>();
+	if (!storage->Open(path, maxBytes)) {
+		const bool created = storage->created;
+		storage.reset();
+		if (created)
+			std::remove(path.c_str());
+		return SpillFilePtr();
+	}
+
+	return SpillFilePtr(new SpillFile(path, std::move(storage), maxBytes));
+}
+
+bool SpillFile::Append(const QueuedData& item)
+{
+	const auto tags = item.tags ? SerializeTags(*item.tags) : std::vector<uint8_t>();
+	const size_t dataSize = item.data ? item.data->size() : 0;
+	const auto size = AlignRecord(sizeof(RecordHeader) + dataSize + tags.size());
+
+	if (!mCount)
+		Clear();
+
+	// A record that does not fit before the end of the file starts over at offset 0.
+	size_t offset = mTail;
+	size_t skipped = 0;
+	if (mMaxBytes - offset < size) {
+		skipped = mMaxBytes - offset;
+		offset = 0;
+	}
+
+	if (mUsed + skipped + size > mMaxBytes)
+		return false;
+
+	if (skipped) {
+		const uint64_t endMark = 0;
+		mStorage->Write(mTail, &endMark, sizeof(endMark));
+	}
+
+	RecordHeader header{};
+	header.size = size;
+	header.flags = (item.data ? RecordHeader::HasData : 0) | (item.tags ? RecordHeader::HasTags : 0);
+	header.dataSize = dataSize;
+	header.tagsSize = tags.size();
+	header.sequence = item.sequence;
+	header.flushEpoch = item.flushEpoch;
+	header.putTimeNs = chrono::duration_cast<chrono::nanoseconds>(item.putTime.time_since_epoch()).count();
+
+	mStorage->Write(offset, &header, sizeof(header));
+	if (dataSize)
+		mStorage->Write(offset + sizeof(header), item.data->data(), dataSize);
+	if (!tags.empty())
+		mStorage->Write(offset + sizeof(header) + dataSize, tags.data(), tags.size());
+
+	mTail = offset + size;
+	mUsed += skipped + size;
+	mCount++;
+
+	return true;
+}
+
+bool SpillFile::Front(QueuedData& item) const
+{
+	if (!mCount)
+		return false;
+
+	const auto offset = GetHeadOffset();
+
+	RecordHeader header;
+	mStorage->Read(offset, &header, sizeof(header));
+
+	item = QueuedData();
+	if (header.flags & RecordHeader::HasData) {
+		item.data = std::make_shared<DataArray>(header.dataSize);
+		if (header.dataSize)
+			mStorage->Read(offset + sizeof(header), item.data->data(), header.dataSize);
+	}
+
+	if (header.flags & RecordHeader::HasTags) {
+		std::vector<uint8_t> tags(header.tagsSize);
+		mStorage->Read(offset + sizeof(header) + header.dataSize, tags.data(), tags.size());
+		item.tags = std::make_shared<const FrameTags>(DeserializeTags(tags));
+	}
+
+	item.sequence = header.sequence;
+	item.flushEpoch = header.flushEpoch;
+	item.putTime = chrono::steady_clock::time_point(
+		chrono::duration_cast<chrono::steady_clock::duration>(chrono::nanoseconds(header.putTimeNs)));
+
+	return true;
+}
+
+void SpillFile::Pop()
+{
+	if (!mCount)
+		return;
+
+	const auto offset = GetHeadOffset();
+	const size_t skipped = offset < mHead ? mMaxBytes - mHead : 0;
+
+	uint64_t size = 0;
+	mStorage->Read(offset, &size, sizeof(size));
+
+	mHead = offset + static_cast<size_t>(size);
+	mUsed -= skipped + static_cast<size_t>(size);
+
+	if (!--mCount)
+		Clear();
+}
+
+void SpillFile::Clear()
+{
+	mHead = 0;
+	mTail = 0;
+	mUsed = 0;
+	mCount = 0;
+}
+
+bool SpillFile::IsEmpty() const
+{
+	return !mCount;
+}
+
+size_t SpillFile::GetCount() const
+{
+	return mCount;
+}
+
+size_t SpillFile::GetBytes() const
+{
+	return mUsed;
+}
+
+size_t SpillFile::GetMaxBytes() const
+{
+	return mMaxBytes;
+}
+
+size_t SpillFile::GetHeadOffset() const
+{
+	if (mMaxBytes - mHead < sizeof(uint64_t))
+		return 0;
+
+	uint64_t size = 0;
+	mStorage->Read(mHead, &size, sizeof(size));
+	return size ? mHead : 0;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "ISplitter.h"
+
+#include <memory>
+#include <string>
+
+// Frames of one client kept in a file instead of memory, for OverflowPolicy::Spill.
+//
+// The file has a fixed size, reserved on disk when it is created, and holds a circular log of
+// frame records: Append() writes at the tail, Front()/Pop() read the oldest record at the head.
+// A frame is stored with its sequence, put time, flush epoch and tags; a frame read back owns a
+// new buffer and no share of the splitter byte budget.
+//
+// On POSIX systems the file is memory mapped and records are copied in and out of the mapping;
+// elsewhere it is read and written through a std::fstream. The file is removed when the object
+// is destroyed. Not thread-safe: the owning client serializes the calls.
+class SpillFile
+{
+public:
+	~SpillFile();
+
+	// Creates the file at path with room for maxBytes of records.
+	// nullptr if the file already exists, cannot be created or the disk space cannot be reserved.
+	static SpillFilePtr Create(const std::string& path, size_t maxBytes);
+
+	// False if the frame does not fit into the free room of the file.
+	bool Append(const QueuedData& item);
+	// Reads the oldest frame without removing it.
+	bool Front(QueuedData& item) const;
+	void Pop();
+	void Clear();
+
+	bool IsEmpty() const;
+	size_t GetCount() const;
+	size_t GetBytes() const;
+	size_t GetMaxBytes() const;
+
+private:
+	struct Storage;
+	struct RecordHeader;
+
+	SpillFile(const std::string& path, std::unique_ptr<Storage> storage, size_t maxBytes);
+
+	SpillFile(const SpillFile& other) = delete;
+	SpillFile& operator=(const SpillFile& other) = delete;
+
+	// Offset of the oldest record, past the unused end of the file if the log wrapped there.
+	size_t GetHeadOffset() const;
+
+private:
+	const std::string mPath;
+	const std::unique_ptr<Storage> mStorage;
+	const size_t mMaxBytes;
+
+	size_t mHead = 0;
+	size_t mTail = 0;
+	// Bytes taken by records and by the unused ends skipped on wrap.
+	size_t mUsed = 0;
+	size_t mCount = 0;
+
+	static const std::string TAG;
+};
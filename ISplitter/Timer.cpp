@@ -2,28 +2,38 @@
 
 void Timer::start()
 {
-	mStartTime = std::chrono::system_clock::now();
+	mStartTime = std::chrono::steady_clock::now();
 	mRunning = true;
 }
 
 void Timer::stop()
 {
-	mEndTime = std::chrono::system_clock::now();
+	mEndTime = std::chrono::steady_clock::now();
 	mRunning = false;
 }
 
 double Timer::elapsed()
+{
+	return std::chrono::duration<double, std::milli>(duration()).count();
+}
+
+double Timer::elapsedMicroseconds()
+{
+	return std::chrono::duration<double, std::micro>(duration()).count();
+}
+
+std::chrono::steady_clock::duration Timer::duration() const
 {
 	TimePoint endTime;
 
 	if (mRunning)
 	{
-		endTime = std::chrono::system_clock::now();
+		endTime = std::chrono::steady_clock::now();
 	}
 	else
 	{
 		endTime = mEndTime;
 	}
 
-	return static_cast<double>(std::chrono::duration_cast<std::chrono::milliseconds>(endTime - mStartTime).count());
+	return endTime - mStartTime;
 }
@@ -2,15 +2,20 @@
 
 #include <chrono>
 
+// Stopwatch on steady_clock, so wall clock adjustments do not show up in the measurements.
 class Timer
 {
 public:
 	void start();
 	void stop();	
+	// Milliseconds, with the fraction down to the clock resolution.
 	double elapsed();	
+	double elapsedMicroseconds();
 
 private:
-	using TimePoint = std::chrono::time_point<std::chrono::system_clock>;
+	using TimePoint = std::chrono::steady_clock::time_point;
+
+	std::chrono::steady_clock::duration duration() const;
 
 	TimePoint mStartTime;
 	TimePoint mEndTime;
@@ -0,0 +1,346 @@
+#pragma once
+
+#include "data_queue.h"
+
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <algorithm>
+
+// Fixed-capacity ring shared by all readers: every pushed value is stored once
+// in a sequence-numbered slot and each reader only keeps its own read cursor.
+// Reader latency is (head - cursor). When the producer times out waiting for a
+// lagging reader, that reader's cursor jumps forward and the skipped values are
+// counted as dropped for it. Readers attached with dropOldest are never waited for,
+// their cursor jumps forward as soon as they lag by the full ring. A reader may be
+// given a smaller depth than the ring, it then counts as lagging at that depth, and
+// a byte budget for the values it has not read yet (see data_queue for value_bytes()).
+template <typename T>
+class broadcast_ring
+{
+public:
+	class reader
+	{
+	private:
+		friend class broadcast_ring;
+
+		uint64_t mCursor = 0;
+		uint64_t mFlushEpoch = 0;
+		size_t mDropped = 0;
+		size_t mDepth = 0;
+		size_t mBytes = 0;
+		size_t mMaxBytes = 0;
+		bool mAttached = true;
+		bool mDropOldest = false;
+	};
+
+	using reader_ptr = std::shared_ptr<reader>;
+
+private:
+	struct slot
+	{
+		T value{};
+		size_t pending = 0;
+	};
+
+	mutable std::mutex mRingMutex;
+	std::condition_variable mPopDataCondition;
+	std::condition_variable mPushDataCondition;
+	std::vector<slot> mSlots;
+	std::vector<reader_ptr> mReaders;
+	uint64_t mHead = 0;
+	const size_t mMaxLength = 0;
+
+	static const std::string TAG;
+
+public:
+	broadcast_ring(size_t maxLength)
+		: mSlots(std::max<size_t>(maxLength, 1))
+		, mMaxLength(std::max<size_t>(maxLength, 1))
+	{}
+
+	virtual ~broadcast_ring()
+	{
+		flush();
+	}
+
+	size_t max_length() const { return mMaxLength; }
+
+	// depth: 0 or more than the ring size - the ring size; maxBytes: 0 - no byte budget.
+	reader_ptr attach(bool dropOldest = false, size_t depth = 0, size_t maxBytes = 0)
+	{
+		auto r = std::make_shared<reader>();
+		r->mDropOldest = dropOldest;
+		r->mDepth = depth && depth < mMaxLength ? depth : mMaxLength;
+		r->mMaxBytes = maxBytes;
+
+		std::scoped_lock lock(mRingMutex);
+		r->mCursor = mHead;
+		mReaders.push_back(r);
+
+		return r;
+	}
+
+	void detach(const reader_ptr& r)
+	{
+		{
+			std::scoped_lock lock(mRingMutex);
+			if (!r->mAttached)
+				return;
+
+			discard(*r);
+			r->mAttached = false;
+			r->mFlushEpoch++;
+			mReaders.erase(std::remove(mReaders.begin(), mReaders.end(), r), mReaders.end());
+		}
+
+		mPopDataCondition.notify_all();
+		mPushDataCondition.notify_all();
+	}
+
+	bool push(T new_value, int32_t nWaitForBuffersFreeTimeOutMsec)
+	{
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds{ std::max(nWaitForBuffersFreeTimeOutMsec, 0) };
+
+		std::unique_lock lock(mRingMutex);
+		auto dropped = publish(new_value, lock, nWaitForBuffersFreeTimeOutMsec == -1 ? nullptr : &deadline);
+
+		lock.unlock();
+		mPopDataCondition.notify_all();
+
+		return !dropped;
+	}
+
+	// Publishes several values under one lock acquisition, waiting until the deadline
+	// (nullptr - infinite) whenever a reader lags by the full ring. Returns the number of
+	// values dropped across all readers.
+	size_t push_batch(const T* values, size_t count, const std::chrono::steady_clock::time_point* pDeadline)
+	{
+		size_t dropped = 0;
+
+		std::unique_lock lock(mRingMutex);
+		for (size_t i = 0; i < count; i++) {
+			T value = values[i];
+			dropped += publish(value, lock, pDeadline);
+		}
+
+		lock.unlock();
+		mPopDataCondition.notify_all();
+
+		return dropped;
+	}
+
+	bool wait_and_pop(reader& r, T& value, int32_t nWaitForNewDataTimeOutMsec)
+	{
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds{ std::max(nWaitForNewDataTimeOutMsec, 0) };
+		return wait_and_pop_until(r, value, nWaitForNewDataTimeOutMsec == -1 ? nullptr : &deadline);
+	}
+
+	// Same as wait_and_pop() against an absolute deadline, nullptr - infinite.
+	bool wait_and_pop_until(reader& r, T& value, const std::chrono::steady_clock::time_point* pDeadline)
+	{
+		std::unique_lock lock(mRingMutex);
+
+		const auto epoch = r.mFlushEpoch;
+		auto ready = [this, &r, epoch] { return r.mFlushEpoch != epoch || r.mCursor != mHead; };
+
+		if (!pDeadline) {
+			mPopDataCondition.wait(lock, ready);
+		}
+		else {
+			if (!mPopDataCondition.wait_until(lock, *pDeadline, ready)) {
+				return false;
+			}
+		}
+
+		if (r.mFlushEpoch != epoch) return false;
+
+		pop(r, value);
+
+		lock.unlock();
+		mPushDataCondition.notify_all();
+
+		return true;
+	}
+
+	bool try_pop(reader& r, T& value)
+	{
+		std::unique_lock lock(mRingMutex);
+		if (!r.mAttached || r.mCursor == mHead)
+			return false;
+
+		pop(r, value);
+
+		lock.unlock();
+		mPushDataCondition.notify_all();
+
+		return true;
+	}
+
+	size_t try_pop_batch(reader& r, std::vector<T>& values, size_t maxCount)
+	{
+		std::unique_lock lock(mRingMutex);
+		if (!r.mAttached)
+			return 0;
+
+		size_t popped = 0;
+		while (popped < maxCount && r.mCursor != mHead) {
+			T value;
+			pop(r, value);
+			values.push_back(std::move(value));
+			popped++;
+		}
+
+		lock.unlock();
+		if (popped) mPushDataCondition.notify_all();
+
+		return popped;
+	}
+
+	size_t size(const reader& r) const
+	{
+		std::scoped_lock lock(mRingMutex);
+		return static_cast<size_t>(mHead - r.mCursor);
+	}
+
+	size_t bytes(const reader& r) const
+	{
+		std::scoped_lock lock(mRingMutex);
+		return r.mBytes;
+	}
+
+	size_t dropped(const reader& r) const
+	{
+		std::scoped_lock lock(mRingMutex);
+		return r.mDropped;
+	}
+
+	void flush(reader& r)
+	{
+		{
+			std::scoped_lock lock(mRingMutex);
+			discard(r);
+			r.mDropped = 0;
+			r.mFlushEpoch++;
+		}
+
+		mPopDataCondition.notify_all();
+		mPushDataCondition.notify_all();
+	}
+
+	void flush()
+	{
+		{
+			std::scoped_lock lock(mRingMutex);
+			for (auto& r : mReaders) {
+				discard(*r);
+				r->mDropped = 0;
+				r->mFlushEpoch++;
+			}
+		}
+
+		mPopDataCondition.notify_all();
+		mPushDataCondition.notify_all();
+	}
+
+private:
+	size_t publish(T& new_value, std::unique_lock<std::mutex>& lock, const std::chrono::steady_clock::time_point* pDeadline)
+	{
+		size_t dropped = 0;
+		const auto bytes = value_bytes(new_value);
+
+		// Earlier values of a batch are not announced yet, readers must see them before we block.
+		if (has_lagging(bytes))
+			mPopDataCondition.notify_all();
+
+		if (!pDeadline) {
+			mPushDataCondition.wait(lock, [this, bytes] { return !has_lagging(bytes); });
+		}
+		else {
+			if (!mPushDataCondition.wait_until(lock, *pDeadline, [this, bytes] { return !has_lagging(bytes); })) {
+
+				for (auto& r : mReaders)
+					dropped += make_room(*r, bytes);
+			}
+		}
+
+		// Readers that are not waited for give up their oldest values to make room.
+		for (auto& r : mReaders) {
+			if (r->mDropOldest)
+				dropped += make_room(*r, bytes);
+		}
+
+		auto& s = mSlots[mHead % mMaxLength];
+		s.pending = mReaders.size();
+		s.value = s.pending ? std::move(new_value) : T{};
+		mHead++;
+
+		for (auto& r : mReaders)
+			r->mBytes += bytes;
+
+		return dropped;
+	}
+
+	bool is_lagging(const reader& r, size_t bytes) const
+	{
+		if (mHead - r.mCursor >= r.mDepth)
+			return true;
+
+		return r.mMaxBytes && r.mBytes && r.mBytes + bytes > r.mMaxBytes;
+	}
+
+	bool has_lagging(size_t bytes) const
+	{
+		for (const auto& r : mReaders) {
+			if (!r->mDropOldest && is_lagging(*r, bytes))
+				return true;
+		}
+		return false;
+	}
+
+	// Moves a lagging reader past its oldest values until the new one fits, returns the number of dropped values.
+	size_t make_room(reader& r, size_t bytes)
+	{
+		size_t dropped = 0;
+		while (is_lagging(r, bytes)) {
+			r.mBytes -= value_bytes(mSlots[r.mCursor % mMaxLength].value);
+			release(r.mCursor++);
+			r.mDropped++;
+			dropped++;
+		}
+		return dropped;
+	}
+
+	void release(uint64_t seq)
+	{
+		auto& s = mSlots[seq % mMaxLength];
+		if (s.pending && --s.pending == 0)
+			s.value = T{};
+	}
+
+	void pop(reader& r, T& value)
+	{
+		auto& s = mSlots[r.mCursor % mMaxLength];
+		r.mBytes -= value_bytes(s.value);
+		if (s.pending == 1)
+			value = std::move(s.value);
+		else
+			value = s.value;
+
+		release(r.mCursor++);
+	}
+
+	void discard(reader& r)
+	{
+		while (r.mCursor != mHead)
+			release(r.mCursor++);
+
+		r.mBytes = 0;
+	}
+};
+
+template<typename T>
+const std::string broadcast_ring<T>::TAG = "broadcast_ring: ";
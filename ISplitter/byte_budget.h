@@ -0,0 +1,59 @@
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <string>
+
+// Byte budget shared by several holders. acquire() waits until the deadline
+// (nullptr - infinite) for the bytes to fit; when nothing is held any value fits,
+// however large. release() gives the bytes back and wakes the waiters.
+class byte_budget
+{
+private:
+	mutable std::mutex mBudgetMutex;
+	std::condition_variable mReleaseCondition;
+	const size_t mMaxBytes = 0;
+	size_t mBytes = 0;
+
+	static const std::string TAG;
+
+public:
+	byte_budget(size_t maxBytes)
+		: mMaxBytes(maxBytes)
+	{}
+
+	size_t max_bytes() const { return mMaxBytes; }
+
+	size_t bytes() const
+	{
+		std::scoped_lock lock(mBudgetMutex);
+		return mBytes;
+	}
+
+	bool acquire(size_t bytes, const std::chrono::steady_clock::time_point* pDeadline)
+	{
+		auto fits = [this, bytes] { return !mBytes || mBytes + bytes <= mMaxBytes; };
+
+		std::unique_lock lock(mBudgetMutex);
+		if (!pDeadline)
+			mReleaseCondition.wait(lock, fits);
+		else if (!mReleaseCondition.wait_until(lock, *pDeadline, fits))
+			return false;
+
+		mBytes += bytes;
+		return true;
+	}
+
+	void release(size_t bytes)
+	{
+		{
+			std::scoped_lock lock(mBudgetMutex);
+			mBytes -= bytes;
+		}
+
+		mReleaseCondition.notify_all();
+	}
+};
+
+inline const std::string byte_budget::TAG = "byte_budget: ";
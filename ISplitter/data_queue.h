@@ -0,0 +1,58 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Common interface of the per-client bounded queues.
+// push() waits up to the timeout (-1 - infinite) for a free buffer, then drops the oldest value
+// and returns false. wait_and_pop() returns false on timeout or when the queue was flushed;
+// wait_and_pop_until() is the same against an absolute deadline (nullptr - infinite).
+// The batch calls move several values under a single lock acquisition: push_batch() waits
+// until the deadline (nullptr - infinite) for each value that does not fit and returns
+// the number of dropped old values.
+// push_evict() never waits: when the queue is full it drops the oldest value right away
+// (returns false then, push_evict_batch() returns the number of dropped values).
+// Besides max_length() a queue may have a byte budget: it is full when the next value's
+// value_bytes() would not fit. An empty queue always takes one value, however large.
+// flush() closes the queue for good; clear() only drops the queued values and makes
+// pending wait_and_pop() calls return false, the queue stays in use.
+template <typename T>
+class data_queue
+{
+public:
+	virtual ~data_queue() = default;
+
+	virtual size_t max_length() const = 0;
+	virtual size_t max_bytes() const = 0;
+
+	virtual bool try_push(const T& new_value) = 0;
+	virtual bool push(T new_value, int32_t nWaitForBuffersFreeTimeOutMsec) = 0;
+	virtual bool push_until(T new_value, const std::chrono::steady_clock::time_point& deadline) = 0;
+
+	virtual size_t try_push_batch(const T* values, size_t count) = 0;
+	virtual size_t push_batch(const T* values, size_t count, const std::chrono::steady_clock::time_point* pDeadline) = 0;
+
+	virtual bool push_evict(T new_value) = 0;
+	virtual size_t push_evict_batch(const T* values, size_t count) = 0;
+
+	virtual bool wait_and_pop(T& value, int32_t nWaitForNewDataTimeOutMsec) = 0;
+	virtual bool wait_and_pop_until(T& value, const std::chrono::steady_clock::time_point* pDeadline) = 0;
+	virtual bool try_pop(T& value) = 0;
+	virtual size_t try_pop_batch(std::vector<T>& values, size_t maxCount) = 0;
+
+	virtual bool empty() const = 0;
+	virtual size_t size() const = 0;
+	virtual size_t bytes() const = 0;
+
+	virtual void clear() = 0;
+	virtual void flush() = 0;
+};
+
+// Bytes a value takes against a byte budget; overloaded for the types that carry a payload.
+template <typename T>
+size_t value_bytes(const T&)
+{
+	return 0;
+}
@@ -0,0 +1,443 @@
+#pragma once
+
+#include "data_queue.h"
+
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+// Bounded lock-free MPMC ring queue (Vyukov's bounded queue): any number of producers and
+// consumers may call it, as with threadsafe_queue.
+// Every cell carries a sequence number, so claiming a cell is a CAS on head or tail:
+// the producer can still evict the oldest value on timeout and concurrent Put/Get
+// callers stay correct. Waiting is only set up when a thread actually has to block on an
+// empty or full queue: with C++20 atomic wait an untimed wait sleeps on an atomic word,
+// timed waits (std::atomic::wait has no deadline) and C++17 builds use condition variables.
+// The byte budget is checked before a cell is claimed, so concurrent producers may
+// overshoot it by one value each.
+template <typename T>
+class lockfree_queue : public data_queue<T>
+{
+private:
+	static constexpr size_t CacheLineSize = 64;
+
+	// Threads blocked on one side of the queue, waiting for data or for free cells.
+	struct wait_point
+	{
+		std::atomic<size_t> waiters{ 0 };
+		std::condition_variable condition;
+#if defined(__cpp_lib_atomic_wait)
+		std::atomic<size_t> signal_waiters{ 0 };
+		std::atomic<uint32_t> signal{ 0 };
+#endif
+	};
+
+	struct alignas(CacheLineSize) cell
+	{
+		std::atomic<uint64_t> sequence{ 0 };
+		T value{};
+	};
+
+	std::unique_ptr<cell[]> mCells;
+	const size_t mMaxLength = 0;
+	// Sequence numbers need at least two cells to tell a written cell from a free one,
+	// a queue of one value keeps a spare cell and checks its length explicitly.
+	const size_t mCellCount = 0;
+	const size_t mMaxBytes = 0;
+
+	alignas(CacheLineSize) std::atomic<uint64_t> mTail{ 0 };
+	alignas(CacheLineSize) std::atomic<uint64_t> mHead{ 0 };
+	alignas(CacheLineSize) std::atomic<size_t> mBytes{ 0 };
+
+	alignas(CacheLineSize) std::atomic_bool mFlushed{ false };
+	std::atomic<uint64_t> mClearEpoch{ 0 };
+	wait_point mPopWait;
+	wait_point mPushWait;
+	std::mutex mWaitMutex;
+
+	static const std::string TAG;
+
+public:
+	// maxBytes: 0 - no byte budget.
+	lockfree_queue(size_t maxLength, size_t maxBytes = 0)
+		: mCells(new cell[std::max<size_t>(maxLength, 2)])
+		, mMaxLength(maxLength ? maxLength : 1)
+		, mCellCount(std::max<size_t>(maxLength, 2))
+		, mMaxBytes(maxBytes)
+	{
+		for (size_t i = 0; i < mCellCount; i++)
+			mCells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	virtual ~lockfree_queue()
+	{
+		flush();
+	}
+
+	size_t max_length() const override { return mMaxLength; }
+	size_t max_bytes() const override { return mMaxBytes; }
+
+	bool try_push(const T& new_value) override
+	{
+		if (mFlushed) return true;
+
+		T value = new_value;
+		if (!enqueue(value))
+			return false;
+
+		notify(mPopWait);
+		return true;
+	}
+
+	bool push(T new_value, int32_t nWaitForBuffersFreeTimeOutMsec) override
+	{
+		if (nWaitForBuffersFreeTimeOutMsec == -1)
+			return push_impl(new_value, nullptr);
+
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds{ nWaitForBuffersFreeTimeOutMsec };
+		return push_impl(new_value, &deadline);
+	}
+
+	bool push_until(T new_value, const std::chrono::steady_clock::time_point& deadline) override
+	{
+		return push_impl(new_value, &deadline);
+	}
+
+	size_t try_push_batch(const T* values, size_t count) override
+	{
+		if (mFlushed) return count;
+
+		size_t pushed = 0;
+		for (; pushed < count; pushed++) {
+			T value = values[pushed];
+			if (!enqueue(value))
+				break;
+		}
+
+		if (pushed) notify(mPopWait);
+		return pushed;
+	}
+
+	size_t push_batch(const T* values, size_t count, const std::chrono::steady_clock::time_point* pDeadline) override
+	{
+		size_t dropped = 0;
+
+		for (size_t i = 0; i < count && !mFlushed; i++) {
+			T value = values[i];
+			if (!enqueue(value))
+				dropped += push_wait(value, pDeadline);
+		}
+
+		notify(mPopWait);
+		return dropped;
+	}
+
+	bool push_evict(T new_value) override
+	{
+		return push_evict_batch(&new_value, 1) == 0;
+	}
+
+	size_t push_evict_batch(const T* values, size_t count) override
+	{
+		if (mFlushed) return 0;
+
+		size_t dropped = 0;
+		for (size_t i = 0; i < count; i++) {
+			T value = values[i];
+			while (!enqueue(value)) {
+				T oldValue;
+				if (dequeue(oldValue))
+					dropped++;
+			}
+		}
+
+		notify(mPopWait);
+		return dropped;
+	}
+
+	bool wait_and_pop(T& value, int32_t nWaitForNewDataTimeOutMsec) override
+	{
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds{ std::max(nWaitForNewDataTimeOutMsec, 0) };
+		return wait_and_pop_until(value, nWaitForNewDataTimeOutMsec == -1 ? nullptr : &deadline);
+	}
+
+	bool wait_and_pop_until(T& value, const std::chrono::steady_clock::time_point* pDeadline) override
+	{
+		const auto epoch = mClearEpoch.load();
+		while (!mFlushed && mClearEpoch.load() == epoch) {
+			if (try_pop(value))
+				return true;
+
+			if (!wait(mPopWait, pDeadline, [this, epoch] { return mFlushed || mClearEpoch.load() != epoch || !empty(); }))
+				return false;
+		}
+
+		return false;
+	}
+
+	bool try_pop(T& value) override
+	{
+		if (!dequeue(value))
+			return false;
+
+		notify(mPushWait);
+		return true;
+	}
+
+	size_t try_pop_batch(std::vector<T>& values, size_t maxCount) override
+	{
+		size_t popped = 0;
+		T value;
+		while (popped < maxCount && dequeue(value)) {
+			values.push_back(std::move(value));
+			popped++;
+		}
+
+		if (popped) notify(mPushWait);
+		return popped;
+	}
+
+	bool empty() const override
+	{
+		auto pos = mHead.load(std::memory_order_acquire);
+		auto seq = mCells[pos % mCellCount].sequence.load(std::memory_order_acquire);
+		return static_cast<int64_t>(seq - (pos + 1)) < 0;
+	}
+
+	size_t size() const override
+	{
+		auto head = mHead.load(std::memory_order_acquire);
+		auto tail = mTail.load(std::memory_order_acquire);
+		return tail > head ? static_cast<size_t>(tail - head) : 0;
+	}
+
+	size_t bytes() const override
+	{
+		return mBytes.load(std::memory_order_relaxed);
+	}
+
+	void clear() override
+	{
+		mClearEpoch.fetch_add(1);
+
+		T value;
+		while (dequeue(value))
+			value = T{};
+
+		wake_all(mPopWait);
+		wake_all(mPushWait);
+	}
+
+	void flush() override
+	{
+		mFlushed = true;
+
+		T value;
+		while (dequeue(value))
+			value = T{};
+
+		wake_all(mPopWait);
+		wake_all(mPushWait);
+	}
+
+private:
+	bool full() const
+	{
+		auto pos = mTail.load(std::memory_order_acquire);
+		auto seq = mCells[pos % mCellCount].sequence.load(std::memory_order_acquire);
+		return static_cast<int64_t>(seq - pos) < 0 || over_length(pos);
+	}
+
+	bool over_bytes(size_t bytes) const
+	{
+		if (!mMaxBytes)
+			return false;
+
+		auto current = mBytes.load(std::memory_order_acquire);
+		return current && current + bytes > mMaxBytes;
+	}
+
+	bool over_length(uint64_t tail) const
+	{
+		return mCellCount != mMaxLength && tail - mHead.load(std::memory_order_acquire) >= mMaxLength;
+	}
+
+	bool enqueue(T& value)
+	{
+		const auto bytes = value_bytes(value);
+		auto pos = mTail.load(std::memory_order_relaxed);
+		cell* c;
+
+		for (;;) {
+			c = &mCells[pos % mCellCount];
+			auto seq = c->sequence.load(std::memory_order_acquire);
+			auto diff = static_cast<int64_t>(seq - pos);
+
+			if (diff == 0) {
+				if (over_length(pos) || over_bytes(bytes))
+					return false;
+				if (mTail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0) {
+				return false;
+			}
+			else {
+				pos = mTail.load(std::memory_order_relaxed);
+			}
+		}
+
+		mBytes.fetch_add(bytes, std::memory_order_relaxed);
+		c->value = std::move(value);
+		c->sequence.store(pos + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	bool dequeue(T& value)
+	{
+		auto pos = mHead.load(std::memory_order_relaxed);
+		cell* c;
+
+		for (;;) {
+			c = &mCells[pos % mCellCount];
+			auto seq = c->sequence.load(std::memory_order_acquire);
+			auto diff = static_cast<int64_t>(seq - (pos + 1));
+
+			if (diff == 0) {
+				if (mHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0) {
+				return false;
+			}
+			else {
+				pos = mHead.load(std::memory_order_relaxed);
+			}
+		}
+
+		value = std::move(c->value);
+		c->value = T{};
+		mBytes.fetch_sub(value_bytes(value), std::memory_order_relaxed);
+		c->sequence.store(pos + mCellCount, std::memory_order_release);
+
+		return true;
+	}
+
+	bool push_impl(T& new_value, const std::chrono::steady_clock::time_point* pDeadline)
+	{
+		if (mFlushed) return false;
+
+		bool result = enqueue(new_value) || !push_wait(new_value, pDeadline);
+		if (mFlushed) return false;
+
+		notify(mPopWait);
+		return result;
+	}
+
+	// Slow path of a push into a full queue, returns the number of dropped values.
+	size_t push_wait(T& new_value, const std::chrono::steady_clock::time_point* pDeadline)
+	{
+		size_t dropped = 0;
+
+		notify(mPopWait);
+
+		do {
+			bool freed = wait(mPushWait, pDeadline, [this, &new_value] { return mFlushed || (!full() && !over_bytes(value_bytes(new_value))); });
+
+			if (mFlushed) return dropped;
+
+			if (!freed) {
+				// Timed out: drop the oldest values until the new one fits.
+				while (!enqueue(new_value)) {
+					T oldValue;
+					if (dequeue(oldValue))
+						dropped++;
+				}
+				break;
+			}
+		} while (!enqueue(new_value));
+
+		return dropped;
+	}
+
+	// The waiter registers before it checks the predicate and the notifier checks for waiters
+	// after it changed the queue, the seq_cst fences on both sides make one of them see the other.
+	template <typename Predicate>
+	bool wait(wait_point& point, const std::chrono::steady_clock::time_point* pDeadline, Predicate predicate)
+	{
+#if defined(__cpp_lib_atomic_wait)
+		if (!pDeadline) {
+			point.signal_waiters.fetch_add(1);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			// The signal is read before the predicate, so a notify in between wakes the wait at once.
+			for (;;) {
+				const auto signal = point.signal.load(std::memory_order_acquire);
+				if (predicate())
+					break;
+				point.signal.wait(signal, std::memory_order_acquire);
+			}
+
+			point.signal_waiters.fetch_sub(1);
+			return true;
+		}
+#endif
+
+		point.waiters.fetch_add(1);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		bool result = true;
+		{
+			std::unique_lock lock(mWaitMutex);
+			if (!pDeadline)
+				point.condition.wait(lock, predicate);
+			else
+				result = point.condition.wait_until(lock, *pDeadline, predicate);
+		}
+
+		point.waiters.fetch_sub(1);
+		return result;
+	}
+
+	void notify(wait_point& point)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+#if defined(__cpp_lib_atomic_wait)
+		if (point.signal_waiters.load(std::memory_order_relaxed)) {
+			point.signal.fetch_add(1, std::memory_order_release);
+			point.signal.notify_all();
+		}
+#endif
+
+		if (!point.waiters.load(std::memory_order_relaxed))
+			return;
+
+		{
+			std::scoped_lock lock(mWaitMutex);
+		}
+		point.condition.notify_all();
+	}
+
+	// clear() and flush(): every waiter rechecks, registered or about to be.
+	void wake_all(wait_point& point)
+	{
+#if defined(__cpp_lib_atomic_wait)
+		point.signal.fetch_add(1, std::memory_order_seq_cst);
+		point.signal.notify_all();
+#endif
+
+		{
+			std::scoped_lock lock(mWaitMutex);
+		}
+		point.condition.notify_all();
+	}
+};
+
+template<typename T>
+const std::string lockfree_queue<T>::TAG = "lockfree_queue: ";
@@ -1,28 +1,44 @@
 #pragma once
 
+#include "data_queue.h"
+
 #include <mutex>
 #include <queue>
 #include <memory>
 #include <string>
 #include <iostream>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <algorithm>
 
 template <typename T>
-class threadsafe_queue
+class threadsafe_queue : public data_queue<T>
 {
 private:
-	mutable std::mutex mDataQueueMutex;
-	std::queue<T> mDataQueue;
-	std::condition_variable mPopDataCondition;
-	std::condition_variable mPushDataCondition;
+	static constexpr size_t CacheLineSize = 64;
+
 	const size_t mMaxLength = 0;
+	const size_t mMaxBytes = 0;
+	std::atomic_bool mFlushed{ false };
+
+	// Put and Get both take the lock, so the lock and what it guards share one line. The condition
+	// variables get lines of their own: Get waits on one while Put notifies it, and the other way round.
+	alignas(CacheLineSize) mutable std::mutex mDataQueueMutex;
+	std::queue<T> mDataQueue;
+	size_t mBytes = 0;
+	uint64_t mClearEpoch = 0;
+
+	alignas(CacheLineSize) std::condition_variable mPopDataCondition;
+	alignas(CacheLineSize) std::condition_variable mPushDataCondition;
 
 	static const std::string TAG;	
-	std::atomic_bool mFlushed{ false };
 
 public:
-	threadsafe_queue(size_t maxLength)
+	// maxBytes: 0 - no byte budget.
+	threadsafe_queue(size_t maxLength, size_t maxBytes = 0)
 		: mMaxLength(maxLength)
+		, mMaxBytes(maxBytes)
 	{}
 
 	virtual ~threadsafe_queue()
@@ -30,10 +46,49 @@ public:
 		flush();
 	}	
 
-	size_t max_length() const { return mMaxLength; }
+	size_t max_length() const override { return mMaxLength; }
+	size_t max_bytes() const override { return mMaxBytes; }
+
+	bool try_push(const T& new_value) override
+	{
+		std::unique_lock lock(mDataQueueMutex);
+		if (mFlushed) return true;
+
+		if (!has_room(new_value))
+			return false;
+
+		push_value(new_value);
+
+		lock.unlock();
+		mPopDataCondition.notify_one();
+
+		return true;
+	}
+
+	// Same as push() with a timeout, but waits against an absolute deadline so that
+	// several queues can share one wait budget.
+	bool push_until(T new_value, const std::chrono::steady_clock::time_point& deadline) override
+	{
+		bool result = true;
+
+		std::unique_lock lock(mDataQueueMutex);
+		if (!mPushDataCondition.wait_until(lock, deadline, [this, &new_value] {return mFlushed || has_room(new_value); })) {
+
+			make_room(new_value);
+			result = false;
+		}
+
+		if (mFlushed) return false;
+
+		push_value(std::move(new_value));
 
+		lock.unlock();
+		mPopDataCondition.notify_one();
+
+		return result;
+	}
 
-	bool push(T new_value, int32_t nWaitForBuffersFreeTimeOutMsec)
+	bool push(T new_value, int32_t nWaitForBuffersFreeTimeOutMsec) override
 	{
 		using namespace std;
 
@@ -45,19 +100,19 @@ public:
 
 		std::unique_lock lock(mDataQueueMutex);
 		if (waitInfinite) {
-			mPushDataCondition.wait(lock, [this] {return mFlushed || (mDataQueue.size() < mMaxLength); });
+			mPushDataCondition.wait(lock, [this, &new_value] {return mFlushed || has_room(new_value); });
 		}
 		else {
-			if (!mPushDataCondition.wait_for(lock, waitMs, [this] {return mFlushed || (mDataQueue.size() < mMaxLength); })) {
+			if (!mPushDataCondition.wait_for(lock, waitMs, [this, &new_value] {return mFlushed || has_room(new_value); })) {
 
-				mDataQueue.pop();
+				make_room(new_value);
 				result = false;
 			}
 		}
 		
 		if (mFlushed) return false;
 			
-		mDataQueue.push (std::move(new_value));
+		push_value(std::move(new_value));
 
 		lock.unlock();
 		mPopDataCondition.notify_one();
@@ -65,30 +120,94 @@ public:
 		return result;
 	}
 
-	bool wait_and_pop(T& value, int32_t nWaitForBuffersFreeTimeOutMsec)
+	size_t try_push_batch(const T* values, size_t count) override
 	{
-		using namespace std;
+		std::unique_lock lock(mDataQueueMutex);
+		if (mFlushed) return count;
 
-		bool waitInfinite = nWaitForBuffersFreeTimeOutMsec == -1;
-		std::chrono::milliseconds waitMs = waitInfinite ?
-			std::chrono::milliseconds{ 0 } : std::chrono::milliseconds{ nWaitForBuffersFreeTimeOutMsec };
+		size_t pushed = 0;
+		while (pushed < count && has_room(values[pushed]))
+			push_value(values[pushed++]);
+
+		lock.unlock();
+		if (pushed) mPopDataCondition.notify_one();
+
+		return pushed;
+	}
+
+	size_t push_batch(const T* values, size_t count, const std::chrono::steady_clock::time_point* pDeadline) override
+	{
+		size_t dropped = 0;
+
+		std::unique_lock lock(mDataQueueMutex);
+		for (size_t i = 0; i < count && !mFlushed; i++) {
+			auto hasFreeBuffer = [this, &values, i] {return mFlushed || has_room(values[i]); };
+
+			if (!pDeadline) {
+				mPushDataCondition.wait(lock, hasFreeBuffer);
+			}
+			else if (!mPushDataCondition.wait_until(lock, *pDeadline, hasFreeBuffer)) {
+				dropped += make_room(values[i]);
+			}
+
+			if (mFlushed) break;
+
+			push_value(values[i]);
+			mPopDataCondition.notify_one();
+		}
+
+		return dropped;
+	}
+
+	bool push_evict(T new_value) override
+	{
+		return push_evict_batch(&new_value, 1) == 0;
+	}
+
+	size_t push_evict_batch(const T* values, size_t count) override
+	{
+		size_t dropped = 0;
 
+		std::unique_lock lock(mDataQueueMutex);
+		if (mFlushed) return 0;
+
+		for (size_t i = 0; i < count; i++) {
+			dropped += make_room(values[i]);
+			push_value(values[i]);
+		}
+
+		lock.unlock();
+		mPopDataCondition.notify_one();
+
+		return dropped;
+	}
+
+	bool wait_and_pop(T& value, int32_t nWaitForBuffersFreeTimeOutMsec) override
+	{
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds{ std::max(nWaitForBuffersFreeTimeOutMsec, 0) };
+		return wait_and_pop_until(value, nWaitForBuffersFreeTimeOutMsec == -1 ? nullptr : &deadline);
+	}
+
+	bool wait_and_pop_until(T& value, const std::chrono::steady_clock::time_point* pDeadline) override
+	{
 		std::unique_lock<std::mutex> lock(mDataQueueMutex);
 
-		if (waitInfinite) {
-			mPopDataCondition.wait(lock, [this] {return mFlushed || !mDataQueue.empty(); });
+		const auto epoch = mClearEpoch;
+		auto ready = [this, epoch] {return mFlushed || mClearEpoch != epoch || !mDataQueue.empty(); };
+
+		if (!pDeadline) {
+			mPopDataCondition.wait(lock, ready);
 		}
 		else {
-			if (!mPopDataCondition.wait_for(lock, waitMs, [this] {return mFlushed || !mDataQueue.empty(); })) {
+			if (!mPopDataCondition.wait_until(lock, *pDeadline, ready)) {
 
 				return false;
 			}
 		}
 
-		if (mFlushed) return false;
+		if (mFlushed || mClearEpoch != epoch) return false;
 
-		value = std::move(mDataQueue.front());
-		mDataQueue.pop();
+		value = pop_value();
 
 		lock.unlock();
 		mPushDataCondition.notify_one();
@@ -103,8 +222,7 @@ public:
 
 		if (mFlushed) return std::shared_ptr<T>{};
 
-		auto res{std::make_shared<T>(std::move(mDataQueue.front())) };
-		mDataQueue.pop();
+		auto res{ std::make_shared<T>(pop_value()) };
 
 		lock.unlock();
 		mPushDataCondition.notify_one();
@@ -112,14 +230,13 @@ public:
 		return res;
 	}
 
-	bool try_pop(T& value)
+	bool try_pop(T& value) override
 	{
 		std::unique_lock lock(mDataQueueMutex);
 		if (mDataQueue.empty())
 			return false;
 
-		value = std::move(mDataQueue.front());
-		mDataQueue.pop();
+		value = pop_value();
 
 		lock.unlock();
 		mPushDataCondition.notify_one();
@@ -127,14 +244,29 @@ public:
 		return true;
 	}
 
+	size_t try_pop_batch(std::vector<T>& values, size_t maxCount) override
+	{
+		std::unique_lock lock(mDataQueueMutex);
+
+		size_t popped = 0;
+		while (popped < maxCount && !mDataQueue.empty()) {
+			values.push_back(pop_value());
+			popped++;
+		}
+
+		lock.unlock();
+		if (popped) mPushDataCondition.notify_all();
+
+		return popped;
+	}
+
 	std::shared_ptr<T> try_pop()
 	{
 		std::unique_lock lock(mDataQueueMutex);
 		if (mDataQueue.empty())
 			return std::shared_ptr<T>();
 
-		auto res{ std::make_shared<T>(std::move(mDataQueue.front())) };
-		mDataQueue.pop();
+		auto res{ std::make_shared<T>(pop_value()) };
 
 		lock.unlock();
 		mPushDataCondition.notify_one();
@@ -142,19 +274,39 @@ public:
 		return res;
 	}
 
-	bool empty() const
+	bool empty() const override
 	{
 		std::scoped_lock lock(mDataQueueMutex);
 		return mDataQueue.empty();
 	}
 
-	size_t size() const 
+	size_t size() const override
 	{
 		std::scoped_lock lock(mDataQueueMutex);
 		return mDataQueue.size();
 	}
 
-	void flush() {	
+	size_t bytes() const override
+	{
+		std::scoped_lock lock(mDataQueueMutex);
+		return mBytes;
+	}
+
+	void clear() override
+	{
+		std::queue<T> values;
+		{
+			std::scoped_lock lock(mDataQueueMutex);
+			std::swap(mDataQueue, values);
+			mBytes = 0;
+			mClearEpoch++;
+		}
+
+		mPopDataCondition.notify_all();
+		mPushDataCondition.notify_all();
+	}
+
+	void flush() override {	
 
 		using namespace std;
 
@@ -162,6 +314,7 @@ public:
 			std::queue<T> empty;
 			std::scoped_lock lock(mDataQueueMutex);
 			std::swap(mDataQueue, empty);
+			mBytes = 0;
 		}
 
 		mFlushed = true;
@@ -169,6 +322,41 @@ public:
 		mPopDataCondition.notify_all();
 		mPushDataCondition.notify_all();
 	}
+
+private:
+	// The helpers below expect mDataQueueMutex to be held.
+	bool has_room(const T& new_value) const
+	{
+		if (mDataQueue.size() >= mMaxLength)
+			return false;
+
+		return !mMaxBytes || mDataQueue.empty() || mBytes + value_bytes(new_value) <= mMaxBytes;
+	}
+
+	// Drops the oldest values until the new one fits, returns the number of dropped values.
+	size_t make_room(const T& new_value)
+	{
+		size_t dropped = 0;
+		while (!mDataQueue.empty() && !has_room(new_value)) {
+			pop_value();
+			dropped++;
+		}
+		return dropped;
+	}
+
+	void push_value(T new_value)
+	{
+		mBytes += value_bytes(new_value);
+		mDataQueue.push(std::move(new_value));
+	}
+
+	T pop_value()
+	{
+		T value = std::move(mDataQueue.front());
+		mDataQueue.pop();
+		mBytes -= value_bytes(value);
+		return value;
+	}
 };
 
 template<typename T>
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <string>
+#include <cstdint>
+
+// Lets holders of sequence numbers pass one at a time in sequence order: wait(n) returns
+// once pass(n - 1) was called. Passing is a single atomic store; a waiter spins, then yields
+// and only then sleeps, the mutex is only taken when somebody sleeps.
+class turnstile
+{
+private:
+	std::atomic<uint64_t> mTurn{ 0 };
+	std::atomic<uint32_t> mSleepers{ 0 };
+	std::atomic_bool mOpen{ false };
+	std::mutex mTurnMutex;
+	std::condition_variable mTurnCondition;
+
+	static constexpr int SpinCount = 64;
+	static constexpr int YieldCount = 64;
+
+	static const std::string TAG;
+
+public:
+	explicit turnstile(uint64_t turn = 0)
+		: mTurn(turn)
+	{}
+
+	// Only while nobody waits.
+	void reset(uint64_t turn) { mTurn.store(turn, std::memory_order_release); }
+
+	void wait(uint64_t sequence)
+	{
+		for (int spin = 0; spin < SpinCount + YieldCount; spin++) {
+			if (mTurn.load(std::memory_order_acquire) == sequence || mOpen.load(std::memory_order_acquire))
+				return;
+
+			if (spin >= SpinCount)
+				std::this_thread::yield();
+		}
+
+		mSleepers.fetch_add(1, std::memory_order_seq_cst);
+		{
+			std::unique_lock lock(mTurnMutex);
+			mTurnCondition.wait(lock, [this, sequence] { return mTurn.load(std::memory_order_seq_cst) == sequence || mOpen; });
+		}
+		mSleepers.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	// Ends the turn of sequence (or of a batch ending with it).
+	void pass(uint64_t sequence)
+	{
+		mTurn.store(sequence + 1, std::memory_order_seq_cst);
+
+		if (mSleepers.load(std::memory_order_seq_cst)) {
+			{ std::scoped_lock lock(mTurnMutex); }
+			mTurnCondition.notify_all();
+		}
+	}
+
+	// From now on wait() returns at once, for sequence holders that can no longer be passed.
+	void open()
+	{
+		mOpen.store(true, std::memory_order_seq_cst);
+
+		{ std::scoped_lock lock(mTurnMutex); }
+		mTurnCondition.notify_all();
+	}
+};
+
+inline const std::string turnstile::TAG = "turnstile: ";
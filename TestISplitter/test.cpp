@@ -2,6 +2,13 @@
 
 #include "ISplitter.h"
 #include "ISplitter.cpp"
+#include "BufferPool.cpp"
+#include "LatencyHistogram.cpp"
+#include "Executor.cpp"
+#include "SharedRing.h"
+#include "SharedRing.cpp"
+#include "SpillFile.h"
+#include "SpillFile.cpp"
 
 #include "Timer.h"
 #include "Timer.cpp"
@@ -12,7 +19,17 @@
 #include <vector>
 #include <limits>
 #include <memory>
+#include <numeric>
 #include <future>
+#include <filesystem>
+#include <fstream>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 using namespace std::chrono;
@@ -56,6 +73,19 @@ TEST_F(TestISplitterBase, test_base_Create)
 
 	ASSERT_EQ(maxBuffers, 2);
 	ASSERT_EQ(maxClients, 3);
+
+	// The buffer pool bound saturates, and the pool keeps nothing for it up front.
+	splitter = ISplitter::Create(16, SIZE_MAX);
+	uint32_t clientId;
+	auto res = splitter->ClientAdd(&clientId);
+	ASSERT_TRUE(res);
+
+	// Client IDs have room for MaxClients slots, more clients are clamped.
+	splitter->InfoGet(&maxBuffers, &maxClients);
+	ASSERT_EQ(maxClients, ISplitter::MaxClients);
+	splitter = ISplitter::Create(2, ISplitter::MaxClients + 1);
+	splitter->InfoGet(&maxBuffers, &maxClients);
+	ASSERT_EQ(maxClients, ISplitter::MaxClients);
 }
 
 TEST_F(TestISplitterBase, test_base_ClientAdd)
@@ -246,6 +276,43 @@ TEST_F(TestISplitterBase, test_base_ClientGetById)
 	ASSERT_EQ(dropped, 0);
 }
 
+TEST_F(TestISplitterBase, test_base_ClientIdReuse)
+{
+	uint32_t id = 0, id2 = 0, id3 = 0;
+	auto res = mSplitter->ClientAdd(&id);
+	ASSERT_TRUE(res);
+	res = mSplitter->ClientAdd(&id2);
+	ASSERT_TRUE(res);
+
+	res = mSplitter->ClientRemove(id);
+	ASSERT_TRUE(res);
+
+	// The freed slot is reused, but the stale ID must not reach the new client.
+	res = mSplitter->ClientAdd(&id3);
+	ASSERT_TRUE(res);
+	ASSERT_NE(id3, id);
+	ASSERT_NE(id3, id2);
+
+	size_t latency;
+	size_t dropped;
+	res = mSplitter->ClientGetById(id, &latency, &dropped);
+	ASSERT_FALSE(res);
+	res = mSplitter->ClientGetById(id3, &latency, &dropped);
+	ASSERT_TRUE(res);
+
+	DataPtr data;
+	ASSERT_EQ(mSplitter->Get(id, data, 0), (int32_t)ISplitter::Error::NoClientFound);
+	ASSERT_EQ(mSplitter->Get(id3, data, 0), (int32_t)ISplitter::Error::NoNewData);
+
+	res = mSplitter->ClientRemove(id);
+	ASSERT_FALSE(res);
+
+	size_t clientCount = 0;
+	res = mSplitter->ClientGetCount(&clientCount);
+	ASSERT_TRUE(res);
+	ASSERT_EQ(clientCount, 2);
+}
+
 
 //=========================================  TestISplitterMain ===================================
 
@@ -1084,4 +1151,2074 @@ TEST_F(TestISplitterMain, test_RemoveAddClients)
 			ASSERT_EQ(getDataAsInt(dataList3[j]), checkSet3[j]);
 		}
 	}//for
-}
\ No newline at end of file
+}
+
+TEST_F(TestISplitterMain, test_Ring_PutGetWithDrop)
+{
+	mSplitter = ISplitter::Create(2, 2, ISplitter::Engine::Ring);
+
+	ClientIds ids;
+	uint32_t id;
+	bool res = mSplitter->ClientAdd(&id);
+	ASSERT_TRUE(res);
+	ids.push_back(id);
+	res = mSplitter->ClientAdd(&id);
+	ASSERT_TRUE(res);
+	ids.push_back(id);
+
+	auto first = makeData(1);
+	ASSERT_EQ(mSplitter->Put(first, 0), 0);
+	ASSERT_EQ(mSplitter->Put(makeData(2), 0), 0);
+
+	size_t latency;
+	size_t dropped;
+	res = mSplitter->ClientGetById(ids[0], &latency, &dropped);
+	ASSERT_TRUE(res);
+	ASSERT_EQ(latency, 2);
+	ASSERT_EQ(dropped, 0);
+
+	DataPtr data;
+	ASSERT_EQ(mSplitter->Get(ids[0], data, 0), 0);
+	ASSERT_EQ(data, first);
+	ASSERT_EQ(getDataAsInt(data), 1);
+
+	// Only the second client still lags by the full ring, so only it loses a frame.
+	auto error = mSplitter->Put(makeData(3), 20);
+	ASSERT_EQ(error, (int32_t)ISplitter::Error::DataDropped);
+
+	res = mSplitter->ClientGetById(ids[0], &latency, &dropped);
+	ASSERT_TRUE(res);
+	ASSERT_EQ(latency, 2);
+	ASSERT_EQ(dropped, 0);
+
+	res = mSplitter->ClientGetById(ids[1], &latency, &dropped);
+	ASSERT_TRUE(res);
+	ASSERT_EQ(latency, 2);
+	ASSERT_EQ(dropped, 1);
+
+	DataSet check1, check2;
+	while (mSplitter->Get(ids[0], data, 0) == 0)
+		check1.push_back(getDataAsInt(data));
+	while (mSplitter->Get(ids[1], data, 0) == 0)
+		check2.push_back(getDataAsInt(data));
+
+	ASSERT_EQ(check1, DataSet({ 2, 3 }));
+	ASSERT_EQ(check2, DataSet({ 2, 3 }));
+
+	res = mSplitter->ClientRemove(ids[1]);
+	ASSERT_TRUE(res);
+	ASSERT_EQ(mSplitter->Put(makeData(4), 0), 0);
+	ASSERT_EQ(mSplitter->Get(ids[1], data, 0), (int32_t)ISplitter::Error::NoClientFound);
+
+	mSplitter->Flush();
+	ASSERT_EQ(mSplitter->Get(ids[0], data, 0), (int32_t)ISplitter::Error::NoNewData);
+}
+
+TEST_F(TestISplitterMain, test_PutSharedDeadline)
+{
+	mSplitter = ISplitter::Create(1, 3);
+
+	ClientIds ids;
+	for (size_t i = 0; i < 3; i++) {
+		uint32_t id;
+		bool res = mSplitter->ClientAdd(&id);
+		ASSERT_TRUE(res);
+		ids.push_back(id);
+	}
+
+	ASSERT_EQ(mSplitter->Put(makeData(1), 50), 0);
+
+	// All three clients are full: the put must wait one timeout, not one per client.
+	Timer tm;
+	tm.start();
+	auto error = mSplitter->Put(makeData(2), 50);
+	auto delayMsec = tm.elapsed();
+	cout << "PutDelay = " << delayMsec << endl;
+
+	ASSERT_EQ(error, (int32_t)ISplitter::Error::DataDropped);
+	ASSERT_LE(delayMsec, 50 + 50 * 0.5);
+
+	for (auto id : ids) {
+		size_t latency;
+		size_t dropped;
+		bool res = mSplitter->ClientGetById(id, &latency, &dropped);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(latency, 1);
+		ASSERT_EQ(dropped, 1);
+
+		DataPtr data;
+		ASSERT_EQ(mSplitter->Get(id, data, 0), 0);
+		ASSERT_EQ(getDataAsInt(data), 2);
+	}
+}
+
+TEST_F(TestISplitterMain, test_LockFreeQueue_PutGet)
+{
+	mSplitter = ISplitter::Create(2, 2, ISplitter::Engine::LockFreeQueue);
+
+	ClientIds ids;
+	uint32_t id;
+	bool res = mSplitter->ClientAdd(&id);
+	ASSERT_TRUE(res);
+	ids.push_back(id);
+	res = mSplitter->ClientAdd(&id);
+	ASSERT_TRUE(res);
+	ids.push_back(id);
+
+	ASSERT_EQ(mSplitter->Put(makeData(1), 0), 0);
+	ASSERT_EQ(mSplitter->Put(makeData(2), 0), 0);
+	ASSERT_EQ(mSplitter->Put(makeData(3), 0), (int32_t)ISplitter::Error::DataDropped);
+
+	size_t latency;
+	size_t dropped;
+	res = mSplitter->ClientGetById(ids[0], &latency, &dropped);
+	ASSERT_TRUE(res);
+	ASSERT_EQ(latency, 2);
+	ASSERT_EQ(dropped, 1);
+
+	DataPtr data;
+	DataSet check;
+	while (mSplitter->Get(ids[0], data, 0) == 0)
+		check.push_back(getDataAsInt(data));
+	ASSERT_EQ(check, DataSet({ 2, 3 }));
+
+	mSplitter->Flush();
+
+	const int count = 200;
+	auto client1Result = std::async(std::launch::async, [this, &ids, count] {
+		DataSet received;
+		DataPtr data;
+		while ((int)received.size() < count && mSplitter->Get(ids[0], data, 1000) == 0)
+			received.push_back(getDataAsInt(data));
+		return received;
+	});
+	auto client2Result = std::async(std::launch::async, [this, &ids, count] {
+		DataSet received;
+		DataPtr data;
+		while ((int)received.size() < count && mSplitter->Get(ids[1], data, 1000) == 0)
+			received.push_back(getDataAsInt(data));
+		return received;
+	});
+
+	for (int i = 1; i <= count; i++) {
+		ASSERT_EQ(mSplitter->Put(makeData(i), -1), 0);
+	}
+
+	auto received1 = client1Result.get();
+	auto received2 = client2Result.get();
+
+	ASSERT_EQ(received1.size(), count);
+	ASSERT_EQ(received2.size(), count);
+	for (int i = 0; i < count; i++) {
+		ASSERT_EQ(received1[i], i + 1);
+		ASSERT_EQ(received2[i], i + 1);
+	}
+
+	// Like the Queue engine it takes several producers: with PutOrder::Any each client gets
+	// every frame once, each producer's frames in the order they were put.
+	auto producer = [this](int first, int last) {
+		for (int i = first; i <= last; i++) {
+			if (mSplitter->Put(makeData(i), -1) != 0)
+				return false;
+		}
+		return true;
+	};
+	auto consumer = [this](uint32_t clientId) {
+		DataSet received;
+		DataPtr data;
+		while ((int)received.size() < count && mSplitter->Get(clientId, data, 1000) == 0)
+			received.push_back(getDataAsInt(data));
+		return received;
+	};
+
+	client1Result = std::async(std::launch::async, consumer, ids[0]);
+	client2Result = std::async(std::launch::async, consumer, ids[1]);
+	auto producer1 = std::async(std::launch::async, producer, 1, count / 2);
+	auto producer2 = std::async(std::launch::async, producer, count / 2 + 1, count);
+	ASSERT_TRUE(producer1.get());
+	ASSERT_TRUE(producer2.get());
+
+	for (auto* result : { &client1Result, &client2Result }) {
+		auto received = result->get();
+		ASSERT_EQ(received.size(), count);
+
+		DataSet first, second;
+		for (auto value : received)
+			(value <= count / 2 ? first : second).push_back(value);
+
+		DataSet expectedFirst(count / 2), expectedSecond(count / 2);
+		std::iota(expectedFirst.begin(), expectedFirst.end(), 1);
+		std::iota(expectedSecond.begin(), expectedSecond.end(), count / 2 + 1);
+		ASSERT_EQ(first, expectedFirst);
+		ASSERT_EQ(second, expectedSecond);
+	}
+}
+
+TEST_F(TestISplitterMain, test_ClientHandle)
+{
+	mSplitter = ISplitter::Create(3, 2);
+
+	ISplitter::ClientHandle handle;
+	ASSERT_FALSE(handle.IsValid());
+
+	handle = mSplitter->ClientAdd();
+	ASSERT_TRUE(handle.IsValid());
+	ASSERT_TRUE(handle.GetClientId() > 0);
+
+	uint32_t id;
+	bool res = mSplitter->ClientAdd(&id);
+	ASSERT_TRUE(res);
+	ASSERT_FALSE(mSplitter->ClientAdd().IsValid());
+
+	size_t latency;
+	size_t dropped;
+	res = mSplitter->ClientGetById(handle.GetClientId(), &latency, &dropped);
+	ASSERT_TRUE(res);
+
+	DataPtr data;
+	ASSERT_EQ(handle.TryGet(data), (int32_t)ISplitter::Error::NoNewData);
+
+	for (int i = 1; i <= 3; i++) {
+		ASSERT_EQ(mSplitter->Put(makeData(i), 0), 0);
+	}
+
+	ASSERT_EQ(handle.Get(data, 0), 0);
+	ASSERT_EQ(getDataAsInt(data), 1);
+
+	DataPtrList dataList;
+	ASSERT_EQ(handle.GetBatch(dataList, 5, 0), 0);
+	ASSERT_EQ(dataList.size(), 2);
+	ASSERT_EQ(getDataAsInt(dataList[0]), 2);
+	ASSERT_EQ(getDataAsInt(dataList[1]), 3);
+
+	// Removing the client interrupts a pending wait and invalidates the handle.
+	auto waitResult = std::async(std::launch::async, [&handle] {
+		DataPtr data;
+		Timer tm;
+		tm.start();
+		auto error = handle.Get(data, 1000);
+		return std::make_pair(error, tm.elapsed());
+	});
+
+	this_thread::sleep_for(50ms);
+	res = mSplitter->ClientRemove(handle.GetClientId());
+	ASSERT_TRUE(res);
+
+	auto[error, delayMsec] = waitResult.get();
+	ASSERT_NE(error, 0);
+	ASSERT_LT(delayMsec, 500);
+
+	ASSERT_FALSE(handle.IsValid());
+	ASSERT_EQ(handle.Get(data, 0), (int32_t)ISplitter::Error::NoClientFound);
+	ASSERT_EQ(handle.TryGet(data), (int32_t)ISplitter::Error::NoClientFound);
+	ASSERT_EQ(handle.GetBatch(dataList, 5, 0), (int32_t)ISplitter::Error::NoClientFound);
+}
+
+
+TEST_F(TestISplitterMain, test_AcquireBuffer)
+{
+	mSplitter = ISplitter::Create(2, 2);
+
+	ClientIds ids;
+	uint32_t id;
+	bool res = mSplitter->ClientAdd(&id);
+	ASSERT_TRUE(res);
+	ids.push_back(id);
+	res = mSplitter->ClientAdd(&id);
+	ASSERT_TRUE(res);
+	ids.push_back(id);
+
+	auto buffer = mSplitter->AcquireBuffer(1024);
+	ASSERT_TRUE(buffer);
+	ASSERT_EQ(buffer->size(), 1024);
+	const auto* memory = buffer->data();
+	(*buffer)[0] = 7;
+
+	ASSERT_EQ(mSplitter->Put(buffer, 0), 0);
+	buffer.reset();
+
+	DataPtr data1, data2;
+	ASSERT_EQ(mSplitter->Get(ids[0], data1, 0), 0);
+	ASSERT_EQ(mSplitter->Get(ids[1], data2, 0), 0);
+	ASSERT_EQ(data1, data2);
+	ASSERT_EQ(getDataAsInt(data1), 7);
+
+	// Still referenced by the clients, so a new buffer must not reuse it.
+	auto other = mSplitter->AcquireBuffer(1024);
+	ASSERT_NE(other->data(), memory);
+	other.reset();
+
+	data1.reset();
+	data2.reset();
+
+	auto recycled = mSplitter->AcquireBuffer(1024);
+	auto recycled2 = mSplitter->AcquireBuffer(1024);
+	ASSERT_TRUE(recycled->data() == memory || recycled2->data() == memory);
+
+	// Buffers may outlive the splitter.
+	mSplitter.reset();
+	recycled.reset();
+	recycled2.reset();
+	mSplitter = ISplitter::Create(2, 2);
+
+	// Free buffers are kept by size class: a small frame does not get a large buffer, and a
+	// frame of the large one's class gets it back without growing it.
+	auto pool = BufferPool::Create(4);
+	auto large = pool->Acquire(1 << 20);
+	const auto* largeMemory = large->data();
+	large.reset();
+
+	auto small = pool->Acquire(100);
+	ASSERT_NE(small->data(), largeMemory);
+	ASSERT_EQ(small->capacity(), 128);
+	small.reset();
+	ASSERT_EQ(pool->GetFreeCount(), 2);
+
+	large = pool->Acquire(1000000);
+	ASSERT_EQ(large->data(), largeMemory);
+	ASSERT_EQ(pool->GetFreeCount(), 1);
+
+	pool->SetMaxCount(0);
+	ASSERT_EQ(pool->GetFreeCount(), 0);
+}
+
+TEST_F(TestISplitterMain, test_PutGetBatch)
+{
+	for (auto engine : { ISplitter::Engine::Queue, ISplitter::Engine::LockFreeQueue, ISplitter::Engine::Ring }) {
+
+		cout << "********* test_PutGetBatch: engine = " << (int)engine << endl;
+
+		mSplitter = ISplitter::Create(3, 2, engine);
+
+		ClientIds ids;
+		uint32_t id;
+		bool res = mSplitter->ClientAdd(&id);
+		ASSERT_TRUE(res);
+		ids.push_back(id);
+		res = mSplitter->ClientAdd(&id);
+		ASSERT_TRUE(res);
+		ids.push_back(id);
+
+		DataPtrList batch;
+		for (int i = 1; i <= 5; i++)
+			batch.push_back(makeData(i));
+
+		size_t droppedTotal = 0;
+		auto error = mSplitter->PutBatch(batch, 0, &droppedTotal);
+		ASSERT_EQ(error, (int32_t)ISplitter::Error::DataDropped);
+		ASSERT_EQ(droppedTotal, 4);
+
+		for (auto clientId : ids) {
+			size_t latency;
+			size_t dropped;
+			res = mSplitter->ClientGetById(clientId, &latency, &dropped);
+			ASSERT_TRUE(res);
+			ASSERT_EQ(latency, 3);
+			ASSERT_EQ(dropped, 2);
+
+			DataPtrList dataList;
+			ASSERT_EQ(mSplitter->GetBatch(clientId, dataList, 10, 0), 0);
+			ASSERT_EQ(dataList.size(), 3);
+			for (size_t j = 0; j < dataList.size(); j++) {
+				ASSERT_EQ(getDataAsInt(dataList[j]), (int)j + 3);
+			}
+
+			ASSERT_EQ(mSplitter->GetBatch(clientId, dataList, 10, 0), (int32_t)ISplitter::Error::NoNewData);
+		}
+
+		// A blocking batch larger than the buffers is delivered completely and in order.
+		const int count = 100;
+		auto clientResult = std::async(std::launch::async, [this, &ids, count] {
+			DataSet received;
+			DataPtrList dataList;
+			while ((int)received.size() < count && mSplitter->GetBatch(ids[0], dataList, 4, 1000) == 0) {
+				for (const auto& data : dataList)
+					received.push_back(getDataAsInt(data));
+			}
+			return received;
+		});
+
+		batch.clear();
+		for (int i = 1; i <= count; i++)
+			batch.push_back(makeData(i));
+
+		res = mSplitter->ClientRemove(ids[1]);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(mSplitter->PutBatch(batch, -1, &droppedTotal), 0);
+		ASSERT_EQ(droppedTotal, 0);
+
+		auto received = clientResult.get();
+		ASSERT_EQ(received.size(), count);
+		for (int i = 0; i < count; i++) {
+			ASSERT_EQ(received[i], i + 1);
+		}
+	}
+}
+
+TEST_F(TestISplitterMain, test_ClientStats)
+{
+	for (auto engine : { ISplitter::Engine::Queue, ISplitter::Engine::LockFreeQueue, ISplitter::Engine::Ring }) {
+
+		cout << "********* test_ClientStats: engine = " << (int)engine << endl;
+
+		mSplitter = ISplitter::Create(1, 2, engine);
+
+		ClientIds ids;
+		uint32_t id;
+		bool res = mSplitter->ClientAdd(&id);
+		ASSERT_TRUE(res);
+		ids.push_back(id);
+		res = mSplitter->ClientAdd(&id);
+		ASSERT_TRUE(res);
+		ids.push_back(id);
+
+		ISplitter::ClientStats stats;
+		ASSERT_FALSE(mSplitter->ClientGetStats(invalidClientId(), &stats));
+		ASSERT_FALSE(mSplitter->ClientGetStats(ids[0], nullptr));
+
+		ASSERT_EQ(mSplitter->Put(makeData(1), 0), 0);
+		this_thread::sleep_for(20ms);
+
+		DataPtr data;
+		ASSERT_EQ(mSplitter->Get(ids[0], data, 0), 0);
+		ASSERT_EQ(mSplitter->Get(ids[0], data, 30), (int32_t)ISplitter::Error::NoNewData);
+
+		// The second client never reads: Put waits for its buffer until the timeout.
+		ASSERT_EQ(mSplitter->Put(makeData(2), 20), (int32_t)ISplitter::Error::DataDropped);
+
+		res = mSplitter->ClientGetStats(ids[0], &stats);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(stats.latency, 1);
+		ASSERT_EQ(stats.dropped, 0);
+		ASSERT_EQ(stats.endToEnd.count, 1);
+		ASSERT_GE(stats.endToEnd.p50Usec, 18000);
+		ASSERT_GE(stats.endToEnd.maxUsec, stats.endToEnd.p999Usec);
+		ASSERT_EQ(stats.getWait.count, 1);
+		ASSERT_GE(stats.getWait.maxUsec, 25000);
+		ASSERT_EQ(stats.putWait.count, 0);
+
+		res = mSplitter->ClientGetStats(ids[1], &stats);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(stats.latency, 1);
+		ASSERT_EQ(stats.dropped, 1);
+		ASSERT_EQ(stats.endToEnd.count, 0);
+		ASSERT_EQ(stats.getWait.count, 0);
+		if (engine != ISplitter::Engine::Ring) {
+			ASSERT_EQ(stats.putWait.count, 1);
+			ASSERT_GE(stats.putWait.maxUsec, 15000);
+		}
+	}
+}
+
+TEST_F(TestISplitterMain, test_OverflowPolicy)
+{
+	for (auto engine : { ISplitter::Engine::Queue, ISplitter::Engine::LockFreeQueue, ISplitter::Engine::Ring }) {
+
+		cout << "********* test_OverflowPolicy: engine = " << (int)engine << endl;
+
+		mSplitter = ISplitter::Create(2, 2, engine);
+
+		uint32_t oldestId;
+		bool res = mSplitter->ClientAdd(&oldestId, ISplitter::OverflowPolicy::DropOldest);
+		ASSERT_TRUE(res);
+		auto newest = mSplitter->ClientAdd(ISplitter::OverflowPolicy::DropNewest);
+		ASSERT_TRUE(newest.IsValid());
+
+		// Nobody reads, still Put never waits for the timeout.
+		Timer tm;
+		tm.start();
+		ASSERT_EQ(mSplitter->Put(makeData(1), 1000), 0);
+		ASSERT_EQ(mSplitter->Put(makeData(2), 1000), 0);
+		ASSERT_EQ(mSplitter->Put(makeData(3), 1000), (int32_t)ISplitter::Error::DataDropped);
+		ASSERT_EQ(mSplitter->Put(makeData(4), 1000), (int32_t)ISplitter::Error::DataDropped);
+
+		DataPtrList batch{ makeData(5), makeData(6) };
+		size_t droppedTotal = 0;
+		ASSERT_EQ(mSplitter->PutBatch(batch, 1000, &droppedTotal), (int32_t)ISplitter::Error::DataDropped);
+		ASSERT_EQ(droppedTotal, 4);
+		ASSERT_LT(tm.elapsed(), 500);
+
+		size_t latency;
+		size_t dropped;
+		res = mSplitter->ClientGetById(oldestId, &latency, &dropped);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(latency, 2);
+		ASSERT_EQ(dropped, 4);
+
+		res = mSplitter->ClientGetById(newest.GetClientId(), &latency, &dropped);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(latency, 2);
+		ASSERT_EQ(dropped, 4);
+
+		DataPtrList dataList;
+		ASSERT_EQ(mSplitter->GetBatch(oldestId, dataList, 10, 0), 0);
+		ASSERT_EQ(dataList.size(), 2);
+		ASSERT_EQ(getDataAsInt(dataList[0]), 5);
+		ASSERT_EQ(getDataAsInt(dataList[1]), 6);
+
+		// The ring reuses the oldest slot, so DropNewest works as DropOldest there.
+		const int first = engine == ISplitter::Engine::Ring ? 5 : 1;
+		ASSERT_EQ(newest.GetBatch(dataList, 10, 0), 0);
+		ASSERT_EQ(dataList.size(), 2);
+		ASSERT_EQ(getDataAsInt(dataList[0]), first);
+		ASSERT_EQ(getDataAsInt(dataList[1]), first + 1);
+	}
+}
+
+TEST_F(TestISplitterMain, test_ClientOptions)
+{
+	for (auto engine : { ISplitter::Engine::Queue, ISplitter::Engine::LockFreeQueue, ISplitter::Engine::Ring }) {
+
+		cout << "********* test_ClientOptions: engine = " << (int)engine << endl;
+
+		mSplitter = ISplitter::Create(3, 3, engine);
+
+		ISplitter::ClientOptions deep;
+		deep.maxBuffers = 5;
+		uint32_t deepId;
+		bool res = mSplitter->ClientAdd(&deepId, deep);
+		ASSERT_TRUE(res);
+
+		ISplitter::ClientOptions display;
+		display.maxBuffers = 1;
+		display.policy = ISplitter::OverflowPolicy::DropOldest;
+		display.priority = 10;
+		auto displayHandle = mSplitter->ClientAdd(display);
+		ASSERT_TRUE(displayHandle.IsValid());
+
+		uint32_t defaultId;
+		res = mSplitter->ClientAdd(&defaultId);
+		ASSERT_TRUE(res);
+
+		// Clients are listed in the order Put serves them.
+		uint32_t id;
+		size_t latency;
+		size_t dropped;
+		res = mSplitter->ClientGetByIndex(0, &id, &latency, &dropped);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(id, displayHandle.GetClientId());
+		res = mSplitter->ClientGetByIndex(1, &id, &latency, &dropped);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(id, deepId);
+		res = mSplitter->ClientGetByIndex(2, &id, &latency, &dropped);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(id, defaultId);
+
+		for (int i = 1; i <= 5; i++) {
+			mSplitter->Put(makeData(i), 0);
+		}
+
+		// The ring has 3 slots, a deeper client is limited to them.
+		const size_t deepBuffers = engine == ISplitter::Engine::Ring ? 3 : 5;
+
+		ISplitter::ClientStats stats;
+		res = mSplitter->ClientGetStats(deepId, &stats);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(stats.maxBuffers, deepBuffers);
+		ASSERT_EQ(stats.priority, 0);
+		ASSERT_EQ(stats.latency, deepBuffers);
+		ASSERT_EQ(stats.dropped, 5 - deepBuffers);
+
+		res = mSplitter->ClientGetStats(displayHandle.GetClientId(), &stats);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(stats.maxBuffers, 1);
+		ASSERT_EQ(stats.priority, 10);
+		ASSERT_EQ(stats.latency, 1);
+		ASSERT_EQ(stats.dropped, 4);
+
+		res = mSplitter->ClientGetStats(defaultId, &stats);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(stats.maxBuffers, 3);
+		ASSERT_EQ(stats.latency, 3);
+		ASSERT_EQ(stats.dropped, 2);
+
+		DataPtr data;
+		ASSERT_EQ(displayHandle.Get(data, 0), 0);
+		ASSERT_EQ(getDataAsInt(data), 5);
+
+		DataPtrList dataList;
+		ASSERT_EQ(mSplitter->GetBatch(deepId, dataList, 10, 0), 0);
+		ASSERT_EQ(dataList.size(), deepBuffers);
+		ASSERT_EQ(getDataAsInt(dataList[0]), (int)(6 - deepBuffers));
+	}
+}
+
+TEST_F(TestISplitterMain, test_ByteBudget)
+{
+	auto makeFrame = [](int i, size_t size) {
+		auto data = std::make_shared<DataArray>(size);
+		(*data)[0] = (uint8_t)i;
+		return data;
+	};
+
+	for (auto engine : { ISplitter::Engine::Queue, ISplitter::Engine::LockFreeQueue, ISplitter::Engine::Ring }) {
+
+		cout << "********* test_ByteBudget: engine = " << (int)engine << endl;
+
+		// Per-client budget: a full budget evicts the oldest frames until the new one fits.
+		mSplitter = ISplitter::Create(10, 2, engine);
+
+		ISplitter::ClientOptions options;
+		options.maxBytes = 3000;
+		uint32_t budgetId;
+		bool res = mSplitter->ClientAdd(&budgetId, options);
+		ASSERT_TRUE(res);
+		uint32_t otherId;
+		res = mSplitter->ClientAdd(&otherId);
+		ASSERT_TRUE(res);
+
+		for (int i = 1; i <= 3; i++) {
+			ASSERT_EQ(mSplitter->Put(makeFrame(i, 1000), 0), 0);
+		}
+		ASSERT_EQ(mSplitter->Put(makeFrame(4, 1500), 0), (int32_t)ISplitter::Error::DataDropped);
+
+		ISplitter::ClientStats stats;
+		res = mSplitter->ClientGetStats(budgetId, &stats);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(stats.maxBytes, 3000);
+		ASSERT_EQ(stats.retainedBytes, 2500);
+		ASSERT_EQ(stats.latency, 2);
+		ASSERT_EQ(stats.dropped, 2);
+
+		res = mSplitter->ClientGetStats(otherId, &stats);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(stats.retainedBytes, 4500);
+		ASSERT_EQ(stats.latency, 4);
+		ASSERT_EQ(stats.dropped, 0);
+
+		DataPtr data;
+		ASSERT_EQ(mSplitter->Get(budgetId, data, 0), 0);
+		ASSERT_EQ(getDataAsInt(data), 3);
+
+		// Splitter budget: shared frames count once, a frame that does not fit in time is dropped for everybody.
+		mSplitter = ISplitter::Create(10, 2, engine, 4000);
+		res = mSplitter->ClientAdd(&budgetId);
+		ASSERT_TRUE(res);
+		res = mSplitter->ClientAdd(&otherId);
+		ASSERT_TRUE(res);
+
+		for (int i = 1; i <= 4; i++) {
+			ASSERT_EQ(mSplitter->Put(makeFrame(i, 1000), 0), 0);
+		}
+
+		size_t maxBytes;
+		size_t retainedBytes;
+		res = mSplitter->InfoGetBytes(&maxBytes, &retainedBytes);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(maxBytes, 4000);
+		ASSERT_EQ(retainedBytes, 4000);
+
+		Timer tm;
+		tm.start();
+		ASSERT_EQ(mSplitter->Put(makeFrame(5, 1000), 20), (int32_t)ISplitter::Error::DataDropped);
+		ASSERT_GE(tm.elapsed(), 15);
+
+		size_t latency;
+		size_t dropped;
+		res = mSplitter->ClientGetById(budgetId, &latency, &dropped);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(latency, 4);
+		ASSERT_EQ(dropped, 1);
+
+		// The bytes return once every client has taken the frame.
+		ASSERT_EQ(mSplitter->Get(budgetId, data, 0), 0);
+		data.reset();
+		res = mSplitter->InfoGetBytes(&maxBytes, &retainedBytes);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(retainedBytes, 4000);
+
+		ASSERT_EQ(mSplitter->Get(otherId, data, 0), 0);
+		data.reset();
+		res = mSplitter->InfoGetBytes(&maxBytes, &retainedBytes);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(retainedBytes, 3000);
+
+		auto putResult = std::async(std::launch::async, [this, &makeFrame] {
+			return mSplitter->Put(makeFrame(6, 2000), 1000);
+		});
+		this_thread::sleep_for(20ms);
+		ASSERT_EQ(mSplitter->Get(budgetId, data, 0), 0);
+		ASSERT_EQ(mSplitter->Get(otherId, data, 0), 0);
+		data.reset();
+		ASSERT_EQ(putResult.get(), 0);
+
+		mSplitter->Flush();
+		res = mSplitter->InfoGetBytes(&maxBytes, &retainedBytes);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(retainedBytes, 0);
+	}
+}
+
+#if defined(__linux__)
+TEST_F(TestISplitterMain, test_SharedRing)
+{
+	const std::string name = "/ISplitterTest_" + std::to_string(getpid());
+
+	auto ring = SharedRing::Create(name, 2, 2, 16);
+	ASSERT_TRUE(ring);
+	ASSERT_FALSE(SharedRing::Create(name, 2, 2, 16));
+
+	ASSERT_EQ(ring->Put(makeData(1), 0), (int32_t)ISplitter::Error::NoClients);
+
+	uint32_t clientId;
+	auto res = ring->ClientAdd(&clientId);
+	ASSERT_TRUE(res);
+
+	ASSERT_EQ(ring->Put(std::make_shared<DataArray>(17), 0), (int32_t)ISplitter::Error::FrameTooLarge);
+
+	// Same drop semantics as the splitter: the oldest unread frame goes when Put times out.
+	ASSERT_EQ(ring->Put(makeData(1), 0), 0);
+	ASSERT_EQ(ring->Put(makeData(2), 0), 0);
+
+	Timer tm;
+	tm.start();
+	ASSERT_EQ(ring->Put(makeData(3), 20), (int32_t)ISplitter::Error::DataDropped);
+	ASSERT_GE(tm.elapsed(), 15);
+
+	size_t latency;
+	size_t dropped;
+	res = ring->ClientGetById(clientId, &latency, &dropped);
+	ASSERT_TRUE(res);
+	ASSERT_EQ(latency, 2);
+	ASSERT_EQ(dropped, 1);
+
+	SharedRing::Frame frame;
+	ASSERT_EQ(ring->Get(clientId, frame, 0), 0);
+	ASSERT_EQ(frame.sequence, 2);
+	ASSERT_EQ(frame.size, 1);
+	ASSERT_EQ(frame.data[0], 2);
+	ASSERT_TRUE(ring->IsValid(frame));
+
+	// The frame in hand stays in place while the client keeps up, and is flagged once a
+	// timed out Put had to reuse its slot.
+	ASSERT_EQ(ring->Put(makeData(4), 0), 0);
+	ASSERT_TRUE(ring->IsValid(frame));
+	ASSERT_EQ(ring->Put(makeData(5), 0), (int32_t)ISplitter::Error::DataDropped);
+	ASSERT_EQ(ring->Put(makeData(6), 0), (int32_t)ISplitter::Error::DataDropped);
+	ASSERT_FALSE(ring->IsValid(frame));
+
+	ASSERT_EQ(ring->Get(clientId, frame, 0), 0);
+	ASSERT_EQ(frame.sequence, 5);
+	ASSERT_EQ(ring->Get(clientId, frame, 0), 0);
+	ASSERT_EQ(frame.sequence, 6);
+	ASSERT_EQ(ring->Get(clientId, frame, 0), (int32_t)ISplitter::Error::NoNewData);
+
+	res = ring->ClientRemove(clientId);
+	ASSERT_TRUE(res);
+	ASSERT_EQ(ring->Get(clientId, frame, 0), (int32_t)ISplitter::Error::NoClientFound);
+
+	// Out-of-process client: attaches by ID, reads every frame in order without drops.
+	res = ring->ClientAdd(&clientId);
+	ASSERT_TRUE(res);
+
+	const int frameCount = 200;
+
+	const pid_t pid = fork();
+	ASSERT_GE(pid, 0);
+	if (pid == 0) {
+		auto remote = SharedRing::Open(name);
+		if (!remote)
+			_exit(1);
+
+		SharedRing::Frame remoteFrame;
+		for (int i = 1; i <= frameCount; i++) {
+			if (remote->Get(clientId, remoteFrame, 5000) != 0)
+				_exit(2);
+			if (remoteFrame.size != 1 || remoteFrame.data[0] != (uint8_t)i || !remote->IsValid(remoteFrame))
+				_exit(3);
+		}
+
+		size_t remoteDropped = 0;
+		remote->ClientGetById(clientId, nullptr, &remoteDropped);
+		_exit(remoteDropped ? 4 : 0);
+	}
+
+	for (int i = 1; i <= frameCount; i++) {
+		ASSERT_EQ(ring->Put(makeData(i), 5000), 0);
+	}
+
+	int status = 0;
+	ASSERT_EQ(waitpid(pid, &status, 0), pid);
+	ASSERT_TRUE(WIFEXITED(status));
+	ASSERT_EQ(WEXITSTATUS(status), 0);
+
+	// Puts from two processes take turns on the one writer slot: every frame arrives whole,
+	// each producer's frames in its order.
+	const pid_t producer = fork();
+	ASSERT_GE(producer, 0);
+	if (producer == 0) {
+		auto remote = SharedRing::Open(name);
+		if (!remote)
+			_exit(1);
+
+		for (int i = 1; i <= frameCount / 2; i++) {
+			if (remote->Put(std::make_shared<DataArray>(16, (uint8_t)i), -1) != 0)
+				_exit(2);
+		}
+		_exit(0);
+	}
+
+	auto consumer = std::async(std::launch::async, [&ring, clientId] {
+		int last[2] = { 0, 0 };
+		SharedRing::Frame frame;
+		for (int i = 0; i < frameCount; i++) {
+			if (ring->Get(clientId, frame, 5000) != 0 || frame.size != 16)
+				return false;
+
+			const uint8_t value = frame.data[0];
+			if (std::count(frame.data, frame.data + frame.size, value) != 16 || !ring->IsValid(frame))
+				return false;
+
+			auto& previous = last[value > frameCount / 2];
+			if (value <= previous)
+				return false;
+			previous = value;
+		}
+		return last[0] == frameCount / 2 && last[1] == frameCount;
+	});
+
+	for (int i = frameCount / 2 + 1; i <= frameCount; i++) {
+		ASSERT_EQ(ring->Put(std::make_shared<DataArray>(16, (uint8_t)i), -1), 0);
+	}
+
+	ASSERT_TRUE(consumer.get());
+	ASSERT_EQ(waitpid(producer, &status, 0), producer);
+	ASSERT_TRUE(WIFEXITED(status));
+	ASSERT_EQ(WEXITSTATUS(status), 0);
+
+	// A Put waiting for its turn behind another process's Put still keeps to its timeout,
+	// and the frame it could not write counts as dropped.
+	ASSERT_EQ(ring->Put(makeData(1), 0), 0);
+	ASSERT_EQ(ring->Put(makeData(2), 0), 0);
+
+	const pid_t blocker = fork();
+	ASSERT_GE(blocker, 0);
+	if (blocker == 0) {
+		auto remote = SharedRing::Open(name);
+		_exit(remote && remote->Put(makeData(3), 2000) == 0 ? 0 : 1);
+	}
+
+	this_thread::sleep_for(100ms);
+	ring->ClientGetById(clientId, nullptr, &dropped);
+	const auto droppedBefore = dropped;
+
+	tm.start();
+	ASSERT_EQ(ring->Put(makeData(4), 50), (int32_t)ISplitter::Error::DataDropped);
+	ASSERT_GE(tm.elapsed(), 40);
+	ASSERT_LT(tm.elapsed(), 1000);
+	ring->ClientGetById(clientId, nullptr, &dropped);
+	ASSERT_EQ(dropped, droppedBefore + 1);
+
+	ASSERT_EQ(ring->Get(clientId, frame, 0), 0);
+	ASSERT_EQ(waitpid(blocker, &status, 0), blocker);
+	ASSERT_TRUE(WIFEXITED(status));
+	ASSERT_EQ(WEXITSTATUS(status), 0);
+
+	ring->Close();
+	ASSERT_EQ(ring->Put(makeData(1), 0), (int32_t)ISplitter::Error::DataFlushed);
+	ASSERT_EQ(ring->Get(clientId, frame, 0), (int32_t)ISplitter::Error::DataFlushed);
+
+	// An owner that crashed leaves its segment behind; Create fails until it is unlinked.
+	const std::string staleName = name + "_stale";
+	const pid_t crashed = fork();
+	ASSERT_GE(crashed, 0);
+	if (crashed == 0) {
+		auto stale = SharedRing::Create(staleName, 2, 2, 16);
+		_exit(stale ? 0 : 1);
+	}
+
+	ASSERT_EQ(waitpid(crashed, &status, 0), crashed);
+	ASSERT_TRUE(WIFEXITED(status));
+	ASSERT_EQ(WEXITSTATUS(status), 0);
+
+	ASSERT_FALSE(SharedRing::Create(staleName, 2, 2, 16));
+	ASSERT_TRUE(SharedRing::Unlink(staleName));
+	ASSERT_FALSE(SharedRing::Unlink(staleName));
+	ASSERT_TRUE(SharedRing::Create(staleName, 2, 2, 16));
+}
+#endif
+
+TEST_F(TestISplitterMain, test_Subscribe)
+{
+	for (auto engine : { ISplitter::Engine::Queue, ISplitter::Engine::Ring, ISplitter::Engine::LockFreeQueue }) {
+		cout << "********* test_Subscribe: engine = " << (int)engine << endl;
+
+		const size_t clientCount = 8;
+		const int frameCount = 200;
+
+		mSplitter = ISplitter::Create(4, clientCount, engine);
+		mSplitter->SetExecutor(Executor::Create(2));
+
+		struct Received {
+			std::mutex mutex;
+			std::condition_variable done;
+			IntList frames;
+			bool ended = false;
+		};
+		std::vector<Received> received(clientCount);
+		std::vector<uint32_t> clientIds(clientCount);
+
+		for (size_t i = 0; i < clientCount; i++) {
+			auto res = mSplitter->ClientAdd(&clientIds[i]);
+			ASSERT_TRUE(res);
+
+			auto& r = received[i];
+			res = mSplitter->Subscribe(clientIds[i], [&r](int32_t errorId, const DataPtr& data) {
+				std::scoped_lock lock(r.mutex);
+				if (errorId)
+					r.ended = true;
+				else
+					r.frames.push_back(data->at(0));
+				r.done.notify_all();
+			});
+			ASSERT_TRUE(res);
+		}
+
+		auto res = mSplitter->Subscribe(clientIds[0], [](int32_t, const DataPtr&) {});
+		ASSERT_FALSE(res);
+		res = mSplitter->Subscribe(invalidClientId(), [](int32_t, const DataPtr&) {});
+		ASSERT_FALSE(res);
+
+		// Two executor threads keep up with eight clients, nothing is dropped.
+		for (int i = 0; i < frameCount; i++) {
+			ASSERT_EQ(mSplitter->Put(makeData(i), -1), 0);
+		}
+
+		for (size_t i = 0; i < clientCount; i++) {
+			auto& r = received[i];
+			std::unique_lock lock(r.mutex);
+			ASSERT_TRUE(r.done.wait_for(lock, 5s, [&r] { return r.frames.size() == frameCount; }));
+			for (int j = 0; j < frameCount; j++) {
+				ASSERT_EQ(r.frames[j], j);
+			}
+		}
+
+		// Removing a client, or closing the splitter, ends the subscription before it returns.
+		res = mSplitter->ClientRemove(clientIds[0]);
+		ASSERT_TRUE(res);
+		{
+			auto& r = received[0];
+			std::scoped_lock lock(r.mutex);
+			ASSERT_TRUE(r.ended);
+		}
+
+		mSplitter->Close();
+		for (size_t i = 1; i < clientCount; i++) {
+			auto& r = received[i];
+			std::scoped_lock lock(r.mutex);
+			ASSERT_TRUE(r.ended);
+		}
+		res = mSplitter->Subscribe(clientIds[1], [](int32_t, const DataPtr&) {});
+		ASSERT_FALSE(res);
+
+		// A callback removing its own client gets the final call after it returns.
+		mSplitter = ISplitter::Create(4, 1, engine);
+		mSplitter->SetExecutor(Executor::Create(1));
+		uint32_t clientId = 0;
+		res = mSplitter->ClientAdd(&clientId);
+		ASSERT_TRUE(res);
+
+		Received selfRemoved;
+		bool removedInCallback = false;
+		res = mSplitter->Subscribe(clientId, [&](int32_t errorId, const DataPtr&) {
+			if (!errorId) {
+				auto removed = mSplitter->ClientRemove(clientId);
+				std::scoped_lock lock(selfRemoved.mutex);
+				removedInCallback = removed;
+				return;
+			}
+
+			std::scoped_lock lock(selfRemoved.mutex);
+			selfRemoved.ended = true;
+			selfRemoved.done.notify_all();
+		});
+		ASSERT_TRUE(res);
+		ASSERT_EQ(mSplitter->Put(makeData(1), -1), 0);
+		{
+			std::unique_lock lock(selfRemoved.mutex);
+			ASSERT_TRUE(selfRemoved.done.wait_for(lock, 5s, [&] { return selfRemoved.ended; }));
+			ASSERT_TRUE(removedInCallback);
+		}
+	}
+}
+
+#if defined(__cpp_impl_coroutine)
+namespace {
+	struct Detached {
+		struct promise_type {
+			Detached get_return_object() { return {}; }
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() {}
+			void unhandled_exception() { std::terminate(); }
+		};
+	};
+
+	Detached readFrames(ISplitterPtr splitter, uint32_t clientId, int count, std::promise<IntList> result)
+	{
+		IntList frames;
+		DataPtr data;
+		for (int i = 0; i < count; i++) {
+			if (co_await splitter->GetAsync(clientId, data) != 0)
+				break;
+			frames.push_back(data->at(0));
+		}
+		result.set_value(frames);
+	}
+}
+
+TEST_F(TestISplitterMain, test_GetAsync)
+{
+	for (auto engine : { ISplitter::Engine::Queue, ISplitter::Engine::Ring, ISplitter::Engine::LockFreeQueue }) {
+		cout << "********* test_GetAsync: engine = " << (int)engine << endl;
+
+		mSplitter = ISplitter::Create(4, 2, engine);
+
+		uint32_t clientId;
+		auto res = mSplitter->ClientAdd(&clientId);
+		ASSERT_TRUE(res);
+
+		std::promise<IntList> promise;
+		auto frames = promise.get_future();
+		readFrames(mSplitter, clientId, 100, std::move(promise));
+
+		for (int i = 0; i < 100; i++) {
+			ASSERT_EQ(mSplitter->Put(makeData(i), -1), 0);
+		}
+
+		ASSERT_EQ(frames.wait_for(5s), std::future_status::ready);
+		auto list = frames.get();
+		ASSERT_EQ(list.size(), 100);
+		for (int i = 0; i < 100; i++) {
+			ASSERT_EQ(list[i], i);
+		}
+
+		DataPtr data;
+		auto error = [&]() -> std::future<int32_t> {
+			std::promise<int32_t> p;
+			auto f = p.get_future();
+			[](ISplitterPtr splitter, uint32_t id, DataPtr& data, std::promise<int32_t> p) -> Detached {
+				p.set_value(co_await splitter->GetAsync(id, data));
+			}(mSplitter, clientId, data, std::move(p));
+			return f;
+		}();
+		this_thread::sleep_for(10ms);
+		mSplitter->ClientRemove(clientId);
+		ASSERT_EQ(error.wait_for(5s), std::future_status::ready);
+		ASSERT_EQ(error.get(), (int32_t)ISplitter::Error::NoClientFound);
+	}
+}
+#endif
+
+#if defined(__linux__)
+TEST_F(TestISplitterMain, test_EventFd)
+{
+	for (auto engine : { ISplitter::Engine::Queue, ISplitter::Engine::Ring, ISplitter::Engine::LockFreeQueue }) {
+		cout << "********* test_EventFd: engine = " << (int)engine << endl;
+
+		mSplitter = ISplitter::Create(4, 2, engine);
+
+		uint32_t firstId;
+		auto res = mSplitter->ClientAdd(&firstId);
+		ASSERT_TRUE(res);
+		auto second = mSplitter->ClientAdd();
+		ASSERT_TRUE(second.IsValid());
+
+		ASSERT_EQ(mSplitter->ClientGetEventFd(invalidClientId()), -1);
+
+		const int firstFd = mSplitter->ClientGetEventFd(firstId);
+		ASSERT_GE(firstFd, 0);
+		// The descriptor is handed out once, a polling loop asking again gets no new one to leak.
+		ASSERT_EQ(mSplitter->ClientGetEventFd(firstId), -1);
+		const int secondFd = second.GetEventFd();
+		ASSERT_GE(secondFd, 0);
+		ASSERT_EQ(second.GetEventFd(), -1);
+
+		const int epollFd = epoll_create1(EPOLL_CLOEXEC);
+		ASSERT_GE(epollFd, 0);
+
+		epoll_event event{};
+		event.events = EPOLLIN;
+		event.data.u32 = firstId;
+		ASSERT_EQ(epoll_ctl(epollFd, EPOLL_CTL_ADD, firstFd, &event), 0);
+		event.data.u32 = second.GetClientId();
+		ASSERT_EQ(epoll_ctl(epollFd, EPOLL_CTL_ADD, secondFd, &event), 0);
+
+		epoll_event ready[2];
+		ASSERT_EQ(epoll_wait(epollFd, ready, 2, 0), 0);
+
+		for (int i = 1; i <= 3; i++) {
+			ASSERT_EQ(mSplitter->Put(makeData(i), 0), 0);
+		}
+		ASSERT_EQ(epoll_wait(epollFd, ready, 2, 0), 2);
+
+		// Draining one client with Get leaves only the other readable, and it stays readable
+		// while frames are left.
+		DataPtr data;
+		for (int i = 1; i <= 3; i++) {
+			ASSERT_EQ(epoll_wait(epollFd, ready, 2, 0), 2);
+			ASSERT_EQ(mSplitter->Get(firstId, data, 1000), 0);
+			ASSERT_EQ(getDataAsInt(data), i);
+		}
+
+		ASSERT_EQ(epoll_wait(epollFd, ready, 2, 0), 1);
+		ASSERT_EQ(ready[0].data.u32, second.GetClientId());
+
+		DataPtrList dataList;
+		ASSERT_EQ(second.GetBatch(dataList, 3, 0), 0);
+		ASSERT_EQ(dataList.size(), 3);
+		ASSERT_EQ(epoll_wait(epollFd, ready, 2, 0), 0);
+
+		// A frame put from another thread wakes the loop.
+		auto putResult = std::async(std::launch::async, [this] {
+			this_thread::sleep_for(10ms);
+			return mSplitter->Put(makeData(4), 0);
+		});
+		ASSERT_GE(epoll_wait(epollFd, ready, 2, 1000), 1);
+		ASSERT_EQ(putResult.get(), 0);
+		ASSERT_EQ(mSplitter->TryGet(firstId, data), 0);
+		ASSERT_EQ(getDataAsInt(data), 4);
+
+		// Removal makes the client readable, TryGet then reports it. The descriptors stay open
+		// and readable after the client objects are gone, until the caller closes them.
+		while (second.TryGet(data) == 0) {}
+		ASSERT_EQ(mSplitter->TryGet(firstId, data), (int32_t)ISplitter::Error::NoNewData);
+		ASSERT_EQ(epoll_wait(epollFd, ready, 2, 0), 0);
+
+		res = mSplitter->ClientRemove(second.GetClientId());
+		ASSERT_TRUE(res);
+		ASSERT_EQ(epoll_wait(epollFd, ready, 2, 0), 1);
+		ASSERT_EQ(second.TryGet(data), (int32_t)ISplitter::Error::NoClientFound);
+
+		res = mSplitter->ClientRemove(firstId);
+		ASSERT_TRUE(res);
+		second = ISplitter::ClientHandle();
+		ASSERT_EQ(epoll_wait(epollFd, ready, 2, 0), 2);
+		ASSERT_NE(fcntl(firstFd, F_GETFD), -1);
+
+		close(firstFd);
+		close(secondFd);
+		close(epollFd);
+	}
+}
+#endif
+
+TEST_F(TestISplitterMain, test_SequencedPut)
+{
+	for (auto engine : { ISplitter::Engine::Queue, ISplitter::Engine::Ring, ISplitter::Engine::LockFreeQueue }) {
+		cout << "********* test_SequencedPut: engine = " << (int)engine << endl;
+
+		const size_t clientCount = 3;
+		const int producerCount = 4;
+		const int framesPerProducer = 500;
+		const size_t frameCount = producerCount * framesPerProducer;
+
+		mSplitter = ISplitter::Create(4, clientCount, engine, 0, ISplitter::PutOrder::Sequenced);
+
+		std::vector<uint32_t> clientIds(clientCount);
+		for (auto& clientId : clientIds) {
+			auto res = mSplitter->ClientAdd(&clientId);
+			ASSERT_TRUE(res);
+		}
+
+		// Frame = producer and frame index; every client must see one and the same interleaving.
+		std::vector<std::vector<uint32_t>> received(clientCount);
+		std::vector<std::thread> consumers;
+		for (size_t i = 0; i < clientCount; i++) {
+			consumers.emplace_back([this, i, &clientIds, &received, frameCount] {
+				DataPtr data;
+				while (received[i].size() < frameCount && mSplitter->Get(clientIds[i], data, 5000) == 0) {
+					uint32_t value;
+					memcpy(&value, data->data(), sizeof(value));
+					received[i].push_back(value);
+				}
+			});
+		}
+
+		std::vector<std::thread> producers;
+		for (int p = 0; p < producerCount; p++) {
+			producers.emplace_back([this, p] {
+				for (int i = 0; i < framesPerProducer; ) {
+					// Odd producers put pairs of frames as one batch.
+					const int count = p % 2 && i + 1 < framesPerProducer ? 2 : 1;
+
+					DataPtrList frames;
+					for (int j = 0; j < count; j++) {
+						const uint32_t value = (p << 16) | (i + j);
+						auto frame = std::make_shared<DataArray>(sizeof(value));
+						memcpy(frame->data(), &value, sizeof(value));
+						frames.push_back(frame);
+					}
+
+					if (count == 1)
+						mSplitter->Put(frames[0], -1);
+					else
+						mSplitter->PutBatch(frames, -1);
+
+					i += count;
+				}
+			});
+		}
+
+		for (auto& producer : producers)
+			producer.join();
+		for (auto& consumer : consumers)
+			consumer.join();
+
+		for (size_t i = 0; i < clientCount; i++) {
+			ASSERT_EQ(received[i].size(), frameCount);
+			ASSERT_EQ(received[i], received[0]);
+		}
+
+		std::vector<int> next(producerCount, 0);
+		for (auto value : received[0]) {
+			const int producer = value >> 16;
+			ASSERT_EQ((int)(value & 0xFFFF), next[producer]++);
+		}
+	}
+}
+
+TEST_F(TestISplitterMain, test_FrameEnvelope)
+{
+	for (auto engine : { ISplitter::Engine::Queue, ISplitter::Engine::Ring, ISplitter::Engine::LockFreeQueue }) {
+		cout << "********* test_FrameEnvelope: engine = " << (int)engine << endl;
+
+		mSplitter = ISplitter::Create(2, 2, engine);
+
+		uint32_t slowId;
+		auto res = mSplitter->ClientAdd(&slowId);
+		ASSERT_TRUE(res);
+		auto fast = mSplitter->ClientAdd();
+		ASSERT_TRUE(fast.IsValid());
+
+		// The fast client keeps up, the slow one loses frames 0..2 to Put timeouts.
+		const auto start = steady_clock::now();
+		for (int i = 0; i < 5; i++) {
+			auto tags = std::make_shared<FrameTags>(FrameTags{ { "index", std::to_string(i) } });
+			mSplitter->Put(makeData(i), i == 4 ? std::move(tags) : FrameTagsPtr(), 0);
+
+			Frame frame;
+			ASSERT_EQ(fast.Get(frame, 0), 0);
+			ASSERT_EQ(frame.sequence, (uint64_t)i);
+			ASSERT_EQ(getDataAsInt(frame.data), i);
+			ASSERT_GE(frame.putTime, start);
+			ASSERT_LE(frame.putTime, steady_clock::now());
+
+			if (i == 4) {
+				ASSERT_TRUE(frame.tags);
+				ASSERT_EQ(frame.tags->at("index"), "4");
+			}
+			else {
+				ASSERT_FALSE(frame.tags);
+			}
+		}
+
+		size_t latency;
+		size_t dropped;
+		res = mSplitter->ClientGetById(slowId, &latency, &dropped);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(dropped, 3);
+
+		// The gap in the sequences names exactly the lost frames.
+		FrameList frames;
+		ASSERT_EQ(mSplitter->GetBatch(slowId, frames, 10, 0), 0);
+		ASSERT_EQ(frames.size(), 2);
+		ASSERT_EQ(frames[0].sequence, 3);
+		ASSERT_EQ(frames[1].sequence, 4);
+		ASSERT_EQ(frames[1].tags->at("index"), "4");
+
+		Frame frame;
+		ASSERT_EQ(mSplitter->TryGet(slowId, frame), (int32_t)ISplitter::Error::NoNewData);
+
+		// Batches take consecutive sequences.
+		ASSERT_EQ(mSplitter->PutBatch({ makeData(5), makeData(6) }, 0), 0);
+		ASSERT_EQ(mSplitter->Get(slowId, frame, 0), 0);
+		ASSERT_EQ(frame.sequence, 5);
+		ASSERT_EQ(mSplitter->TryGet(slowId, frame), 0);
+		ASSERT_EQ(frame.sequence, 6);
+		ASSERT_EQ(getDataAsInt(frame.data), 6);
+	}
+
+	// A frame the splitter byte budget drops leaves its gap too.
+	mSplitter = ISplitter::Create(4, 1, ISplitter::Engine::Queue, 1);
+
+	uint32_t clientId;
+	auto res = mSplitter->ClientAdd(&clientId);
+	ASSERT_TRUE(res);
+
+	ASSERT_EQ(mSplitter->Put(makeData(0), 0), 0);
+	ASSERT_EQ(mSplitter->Put(makeData(1), 0), (int32_t)ISplitter::Error::DataDropped);
+
+	Frame frame;
+	ASSERT_EQ(mSplitter->Get(clientId, frame, 0), 0);
+	ASSERT_EQ(frame.sequence, 0);
+	frame = Frame();
+	ASSERT_EQ(mSplitter->Put(makeData(2), 0), 0);
+	ASSERT_EQ(mSplitter->Get(clientId, frame, 0), 0);
+	ASSERT_EQ(frame.sequence, 2);
+}
+
+TEST_F(TestISplitterMain, test_ClientChurn)
+{
+	for (auto engine : { ISplitter::Engine::Queue, ISplitter::Engine::Ring, ISplitter::Engine::LockFreeQueue }) {
+		cout << "********* test_ClientChurn: engine = " << (int)engine << endl;
+
+		mSplitter = ISplitter::Create(1, 4, engine);
+
+		uint32_t fullId;
+		auto res = mSplitter->ClientAdd(&fullId);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(mSplitter->Put(makeData(0), 0), 0);
+
+		// The second Put waits for the full client for a second...
+		auto blockedPut = std::async(std::launch::async, [this] { return mSplitter->Put(makeData(1), 1000); });
+		this_thread::sleep_for(50ms);
+
+		// ...which must not hold up adding and removing clients meanwhile.
+		Timer tm;
+		tm.start();
+		for (int i = 0; i < 10; i++) {
+			uint32_t clientId;
+			res = mSplitter->ClientAdd(&clientId);
+			ASSERT_TRUE(res);
+			res = mSplitter->ClientRemove(clientId);
+			ASSERT_TRUE(res);
+		}
+		ASSERT_LT(tm.elapsed(), 500);
+
+		ASSERT_EQ(blockedPut.wait_for(0ms), std::future_status::timeout);
+		ASSERT_EQ(blockedPut.get(), (int32_t)ISplitter::Error::DataDropped);
+	}
+
+	// Clients joining and leaving a sequenced splitter neither stall the producers nor disturb the order.
+	for (auto engine : { ISplitter::Engine::Queue, ISplitter::Engine::Ring, ISplitter::Engine::LockFreeQueue }) {
+		cout << "********* test_ClientChurn: sequenced, engine = " << (int)engine << endl;
+
+		mSplitter = ISplitter::Create(4, 4, engine, 0, ISplitter::PutOrder::Sequenced);
+
+		auto steady = mSplitter->ClientAdd();
+		ASSERT_TRUE(steady.IsValid());
+
+		std::atomic_bool stop{ false };
+		std::vector<std::thread> producers;
+		for (int p = 0; p < 2; p++) {
+			producers.emplace_back([this, &stop] {
+				while (!stop) {
+					mSplitter->Put(makeData(0), 0);
+					mSplitter->PutBatch({ makeData(1), makeData(2) }, 0);
+				}
+			});
+		}
+
+		std::thread churn([this] {
+			for (int i = 0; i < 200; i++) {
+				uint32_t clientId;
+				if (mSplitter->ClientAdd(&clientId))
+					mSplitter->ClientRemove(clientId);
+			}
+		});
+
+		size_t received = 0;
+		uint64_t lastSequence = 0;
+		Frame frame;
+		while (received < 2000 && steady.Get(frame, 1000) == 0) {
+			if (received) {
+				ASSERT_GT(frame.sequence, lastSequence);
+			}
+
+			lastSequence = frame.sequence;
+			received++;
+		}
+
+		churn.join();
+		stop = true;
+		for (auto& producer : producers)
+			producer.join();
+
+		ASSERT_EQ(received, 2000);
+	}
+}
+
+TEST_F(TestISplitterMain, test_FlushEpoch)
+{
+	for (auto engine : { ISplitter::Engine::Queue, ISplitter::Engine::Ring, ISplitter::Engine::LockFreeQueue }) {
+		cout << "********* test_FlushEpoch: engine = " << (int)engine << endl;
+
+		mSplitter = ISplitter::Create(1, 1, engine);
+
+		uint32_t clientId;
+		auto res = mSplitter->ClientAdd(&clientId);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(mSplitter->Put(makeData(0), 0), 0);
+
+		// Flush neither waits for a blocked Put nor leaves it blocked...
+		auto blockedPut = std::async(std::launch::async, [this] { return mSplitter->Put(makeData(1), 1000); });
+		this_thread::sleep_for(50ms);
+
+		Timer tm;
+		tm.start();
+		ASSERT_EQ(mSplitter->Flush(), (int32_t)ISplitter::Error::DataFlushed);
+		ASSERT_EQ(blockedPut.get(), 0);
+		ASSERT_LT(tm.elapsed(), 500);
+
+		// ...but the frame it put belongs to the flushed epoch.
+		DataPtr data;
+		ASSERT_EQ(mSplitter->Get(clientId, data, 0), (int32_t)ISplitter::Error::NoNewData);
+
+		ASSERT_EQ(mSplitter->Put(makeData(2), 0), 0);
+		ASSERT_EQ(mSplitter->Get(clientId, data, 0), 0);
+		ASSERT_EQ(getDataAsInt(data), 2);
+
+		// A waiting Get returns on Flush.
+		auto waitingGet = std::async(std::launch::async, [this, clientId] { DataPtr data; return mSplitter->Get(clientId, data, 1000); });
+		this_thread::sleep_for(50ms);
+
+		tm.start();
+		mSplitter->Flush();
+		ASSERT_EQ(waitingGet.get(), (int32_t)ISplitter::Error::NoNewData);
+		ASSERT_LT(tm.elapsed(), 500);
+
+		// The client keeps working after any number of flushes.
+		for (int i = 3; i < 6; i++) {
+			ASSERT_EQ(mSplitter->Put(makeData(i), 0), 0);
+			mSplitter->Flush();
+		}
+		ASSERT_EQ(mSplitter->Put(makeData(6), 0), 0);
+		ASSERT_EQ(mSplitter->Get(clientId, data, 0), 0);
+		ASSERT_EQ(getDataAsInt(data), 6);
+	}
+}
+
+TEST_F(TestISplitterMain, test_ChronoTimeouts)
+{
+	for (auto engine : { ISplitter::Engine::Queue, ISplitter::Engine::Ring, ISplitter::Engine::LockFreeQueue }) {
+		cout << "********* test_ChronoTimeouts: engine = " << (int)engine << endl;
+
+		mSplitter = ISplitter::Create(1, 1, engine);
+
+		auto client = mSplitter->ClientAdd();
+		ASSERT_TRUE(client.IsValid());
+		const auto clientId = client.GetClientId();
+
+		// Sub-millisecond timeouts are waited out, not rounded away.
+		Timer tm;
+		DataPtr data;
+		tm.start();
+		ASSERT_EQ(mSplitter->Get(clientId, data, 700us), (int32_t)ISplitter::Error::NoNewData);
+		ASSERT_GE(tm.elapsedMicroseconds(), 700);
+
+		tm.start();
+		ASSERT_EQ(client.Get(data, 1500us), (int32_t)ISplitter::Error::NoNewData);
+		ASSERT_GE(tm.elapsedMicroseconds(), 1500);
+
+		// A deadline in the past means no wait.
+		tm.start();
+		ASSERT_EQ(mSplitter->GetUntil(clientId, data, steady_clock::now() - 1s), (int32_t)ISplitter::Error::NoNewData);
+		ASSERT_LT(tm.elapsed(), 50);
+
+		ASSERT_EQ(mSplitter->Put(makeData(1), 500us), 0);
+
+		// The client is full: Put waits out its timeout and drops the oldest frame.
+		tm.start();
+		ASSERT_EQ(mSplitter->Put(makeData(2), 1200us), (int32_t)ISplitter::Error::DataDropped);
+		ASSERT_GE(tm.elapsedMicroseconds(), 1200);
+
+		// One deadline shared by the calls of a frame.
+		const auto deadline = steady_clock::now() + 2ms;
+		ASSERT_EQ(mSplitter->PutUntil(makeData(3), deadline), (int32_t)ISplitter::Error::DataDropped);
+		ASSERT_GE(steady_clock::now(), deadline);
+
+		Frame frame;
+		ASSERT_EQ(client.GetUntil(frame, steady_clock::now() + 1ms), 0);
+		ASSERT_EQ(getDataAsInt(frame.data), 3);
+
+		auto tags = std::make_shared<FrameTags>(FrameTags{ { "scene", "1" } });
+		ASSERT_EQ(mSplitter->Put(makeData(4), tags, 1ms), 0);
+		ASSERT_EQ(mSplitter->Get(clientId, frame, 1ms), 0);
+		ASSERT_EQ(getDataAsInt(frame.data), 4);
+		ASSERT_EQ(frame.tags->at("scene"), "1");
+	}
+}
+
+TEST_F(TestISplitterMain, test_SpillToDisk)
+{
+	const auto spillPath = (std::filesystem::temp_directory_path() / "isplitter_test_spill.bin").string();
+
+	for (auto engine : { ISplitter::Engine::Queue, ISplitter::Engine::LockFreeQueue }) {
+		cout << "********* test_SpillToDisk: engine = " << (int)engine << endl;
+
+		mSplitter = ISplitter::Create(2, 2, engine);
+
+		ISplitter::ClientOptions options;
+		options.policy = ISplitter::OverflowPolicy::Spill;
+		options.spillPath = spillPath;
+		options.spillBytes = 64 << 10;
+
+		uint32_t clientId;
+		auto res = mSplitter->ClientAdd(&clientId, options);
+		ASSERT_TRUE(res);
+		ASSERT_TRUE(std::filesystem::exists(spillPath));
+
+		// A client that does not read loses nothing, and Put never waits for it.
+		Timer tm;
+		tm.start();
+		const int frameCount = 100;
+		for (int i = 0; i < frameCount; i++) {
+			auto tags = i % 10 ? FrameTagsPtr() : std::make_shared<FrameTags>(FrameTags{ { "index", std::to_string(i) } });
+			ASSERT_EQ(mSplitter->Put(makeData(i), std::move(tags), 1000), 0);
+		}
+		ASSERT_LT(tm.elapsed(), 500);
+
+		ISplitter::ClientStats stats;
+		res = mSplitter->ClientGetStats(clientId, &stats);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(stats.latency, frameCount);
+		ASSERT_EQ(stats.spilled, frameCount - 2);
+		ASSERT_EQ(stats.dropped, 0);
+
+		// Get replays them in put order, metadata included.
+		for (int i = 0; i < frameCount; i++) {
+			Frame frame;
+			ASSERT_EQ(mSplitter->Get(clientId, frame, 0), 0);
+			ASSERT_EQ(getDataAsInt(frame.data), i);
+			ASSERT_EQ(frame.sequence, (uint64_t)i);
+			if (i % 10) {
+				ASSERT_FALSE(frame.tags);
+			}
+			else {
+				ASSERT_EQ(frame.tags->at("index"), std::to_string(i));
+			}
+		}
+
+		DataPtr data;
+		ASSERT_EQ(mSplitter->Get(clientId, data, 0), (int32_t)ISplitter::Error::NoNewData);
+
+		// The file is a ring: a consumer that keeps up with a lag goes around it many times.
+		int next = 0;
+		for (int i = 0; i < 3000; i++) {
+			ASSERT_EQ(mSplitter->Put(makeData(i), 0), 0);
+			if (i % 3 == 2) {
+				DataPtrList dataList;
+				ASSERT_EQ(mSplitter->GetBatch(clientId, dataList, 2, 0), 0);
+				for (const auto& item : dataList)
+					ASSERT_EQ(getDataAsInt(item), next++ & 0xff);
+
+				ASSERT_EQ(mSplitter->Get(clientId, data, 0), 0);
+				ASSERT_EQ(getDataAsInt(data), next++ & 0xff);
+			}
+		}
+		while (mSplitter->Get(clientId, data, 0) == 0)
+			ASSERT_EQ(getDataAsInt(data), next++ & 0xff);
+		ASSERT_EQ(next, 3000);
+
+		// Flush empties the file too.
+		for (int i = 0; i < 10; i++)
+			mSplitter->Put(makeData(i), 0);
+		mSplitter->Flush();
+		ASSERT_EQ(mSplitter->Get(clientId, data, 0), (int32_t)ISplitter::Error::NoNewData);
+
+		res = mSplitter->ClientRemove(clientId);
+		ASSERT_TRUE(res);
+		ASSERT_FALSE(std::filesystem::exists(spillPath));
+
+		// Beyond the disk budget new frames are dropped, the spilled ones stay.
+		options.spillBytes = 256;
+		res = mSplitter->ClientAdd(&clientId, options);
+		ASSERT_TRUE(res);
+
+		int dropped = 0;
+		for (int i = 0; i < 20; i++) {
+			if (mSplitter->Put(makeData(i), 0) == (int32_t)ISplitter::Error::DataDropped)
+				dropped++;
+		}
+		ASSERT_GT(dropped, 0);
+
+		size_t latency;
+		size_t droppedCount;
+		res = mSplitter->ClientGetById(clientId, &latency, &droppedCount);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(droppedCount, dropped);
+		ASSERT_EQ(latency, 20 - dropped);
+
+		for (int i = 0; i < 20 - dropped; i++) {
+			ASSERT_EQ(mSplitter->Get(clientId, data, 0), 0);
+			ASSERT_EQ(getDataAsInt(data), i);
+		}
+
+		mSplitter.reset();
+		ASSERT_FALSE(std::filesystem::exists(spillPath));
+	}
+
+	// The Ring engine has no per-client queue to spill from, and a client needs its file.
+	mSplitter = ISplitter::Create(2, 2, ISplitter::Engine::Ring);
+
+	ISplitter::ClientOptions options;
+	options.policy = ISplitter::OverflowPolicy::Spill;
+	options.spillPath = spillPath;
+	options.spillBytes = 4096;
+	ASSERT_FALSE(mSplitter->ClientAdd(options).IsValid());
+
+	mSplitter = ISplitter::Create(2, 2);
+	options.spillPath = (std::filesystem::temp_directory_path() / "no_such_dir" / "spill.bin").string();
+	ASSERT_FALSE(mSplitter->ClientAdd(options).IsValid());
+
+	size_t count;
+	mSplitter->ClientGetCount(&count);
+	ASSERT_EQ(count, 0);
+
+	// An existing file, the user's or another client's, fails the add and is left alone.
+	options.spillPath = spillPath;
+	{
+		std::ofstream file(spillPath, std::ios::binary);
+		file << "user data";
+	}
+	ASSERT_FALSE(mSplitter->ClientAdd(options).IsValid());
+	ASSERT_EQ(std::filesystem::file_size(spillPath), 9);
+	std::filesystem::remove(spillPath);
+
+	auto spilling = mSplitter->ClientAdd(options);
+	ASSERT_TRUE(spilling.IsValid());
+	ASSERT_FALSE(mSplitter->ClientAdd(options).IsValid());
+	ASSERT_TRUE(std::filesystem::exists(spillPath));
+
+	// A full splitter does not touch the file either.
+	const auto otherPath = (std::filesystem::temp_directory_path() / "isplitter_test_spill_other.bin").string();
+	ASSERT_TRUE(mSplitter->ClientAdd().IsValid());
+	{
+		std::ofstream file(otherPath, std::ios::binary);
+		file << "user data";
+	}
+	options.spillPath = otherPath;
+	ASSERT_FALSE(mSplitter->ClientAdd(options).IsValid());
+	ASSERT_EQ(std::filesystem::file_size(otherPath), 9);
+	std::filesystem::remove(otherPath);
+
+	spilling = ISplitter::ClientHandle();
+	mSplitter = ISplitter::Create(2, 2);
+	ASSERT_FALSE(std::filesystem::exists(spillPath));
+}
+
+TEST_F(TestISplitterMain, test_FrameView)
+{
+	// A 4 x 3 frame of interleaved channels: byte = row * 16 + channel.
+	auto makeFrame = [] {
+		auto data = std::make_shared<DataArray>();
+		for (uint8_t row = 0; row < 4; row++) {
+			for (uint8_t channel = 0; channel < 3; channel++)
+				data->push_back(row * 16 + channel);
+		}
+		return data;
+	};
+
+	for (auto engine : { ISplitter::Engine::Queue, ISplitter::Engine::Ring, ISplitter::Engine::LockFreeQueue }) {
+		cout << "********* test_FrameView: engine = " << (int)engine << endl;
+
+		mSplitter = ISplitter::Create(4, 3, engine);
+
+		// Channel 1 of every row, the last two rows, and the whole frame.
+		ISplitter::ClientOptions options;
+		options.slice = FrameSlice{ 1, 1, 3, 0 };
+		auto channel = mSplitter->ClientAdd(options);
+		ASSERT_TRUE(channel.IsValid());
+		options.slice = FrameSlice{ 6, 6, 0, 1 };
+		uint32_t cropId;
+		auto res = mSplitter->ClientAdd(&cropId, options);
+		ASSERT_TRUE(res);
+		auto whole = mSplitter->ClientAdd();
+		ASSERT_TRUE(whole.IsValid());
+
+		auto data = makeFrame();
+		auto tags = std::make_shared<FrameTags>(FrameTags{ { "camera", "1" } });
+		ASSERT_EQ(mSplitter->Put(data, tags, 0), 0);
+
+		// Every view points into the buffer Put was given.
+		FrameView view;
+		ASSERT_EQ(channel.Get(view, 0), 0);
+		ASSERT_EQ(view.parent.get(), data.get());
+		ASSERT_EQ(view.rows, 4);
+		ASSERT_EQ(view.GetSize(), 4);
+		ASSERT_EQ(view.GetRow(0), data->data() + 1);
+		ASSERT_EQ(view.ToArray(), (DataArray{ 1, 17, 33, 49 }));
+		ASSERT_EQ(view.GetRow(4), nullptr);
+		ASSERT_EQ(view.sequence, 0);
+		ASSERT_EQ(view.tags->at("camera"), "1");
+
+		ASSERT_EQ(mSplitter->TryGet(cropId, view), 0);
+		ASSERT_EQ(view.parent.get(), data.get());
+		ASSERT_EQ(view.rows, 1);
+		ASSERT_EQ(view.ToArray(), (DataArray{ 32, 33, 34, 48, 49, 50 }));
+
+		ASSERT_EQ(whole.Get(view, 0), 0);
+		ASSERT_EQ(view.parent.get(), data.get());
+		ASSERT_EQ(view.ToArray(), *data);
+
+		// Other Get versions ignore the slice; rows that do not fit a short frame are left out.
+		ASSERT_EQ(mSplitter->Put(makeFrame(), 0), 0);
+		ASSERT_EQ(mSplitter->Put(std::make_shared<DataArray>(DataArray{ 0, 1, 2, 16, 17 }), 0), 0);
+
+		DataPtr full;
+		ASSERT_EQ(channel.Get(full, 0), 0);
+		ASSERT_EQ(full->size(), 12);
+		ASSERT_EQ(channel.Get(view, 0), 0);
+		ASSERT_EQ(view.ToArray(), (DataArray{ 1, 17 }));
+
+		FrameViewList views;
+		ASSERT_EQ(mSplitter->GetBatch(cropId, views, 10, 0), 0);
+		ASSERT_EQ(views.size(), 2);
+		ASSERT_EQ(views[0].rows, 1);
+		ASSERT_EQ(views[0].sequence, 1);
+		ASSERT_EQ(views[1].rows, 0);
+		ASSERT_EQ(views[1].GetSize(), 0);
+		ASSERT_TRUE(views[1].ToArray().empty());
+	}
+
+	// Slices of a frame outside the splitter.
+	auto data = makeFrame();
+	auto view = FrameView::Make(data, FrameSlice{ 3, 0, 0, 1 });
+	ASSERT_EQ(view.GetSize(), 9);
+	view = FrameView::Make(data, FrameSlice{ 20, 2, 0, 0 });
+	ASSERT_EQ(view.rows, 0);
+	view = FrameView::Make(data, FrameSlice{ 0, 2, 3, 0 });
+	ASSERT_EQ(view.rows, 4);
+	ASSERT_EQ(view.ToArray(), (DataArray{ 0, 1, 16, 17, 32, 33, 48, 49 }));
+	view = FrameView::Make(nullptr, FrameSlice());
+	ASSERT_EQ(view.rows, 0);
+}
+
+TEST_F(TestISplitterMain, test_TransformStage)
+{
+	const auto testThread = this_thread::get_id();
+
+	for (auto engine : { ISplitter::Engine::Queue, ISplitter::Engine::Ring, ISplitter::Engine::LockFreeQueue }) {
+		cout << "********* test_TransformStage: engine = " << (int)engine << endl;
+
+		mSplitter = ISplitter::Create(16, 4, engine);
+		mSplitter->SetExecutor(Executor::Create(2));
+
+		// Doubles the value; counts its runs and whether any ran on the Put thread.
+		std::atomic<int> runs{ 0 };
+		std::atomic_bool onPutThread{ false };
+		auto stage = std::make_shared<const FrameTransform>([&](const Frame& frame) {
+			runs++;
+			if (this_thread::get_id() == testThread)
+				onPutThread = true;
+			return std::make_shared<DataArray>(DataArray{ (uint8_t)(frame.data->at(0) * 2) });
+		});
+
+		ISplitter::ClientOptions options;
+		options.transform = stage;
+		auto first = mSplitter->ClientAdd(options);
+		ASSERT_TRUE(first.IsValid());
+		uint32_t secondId;
+		auto res = mSplitter->ClientAdd(&secondId, options);
+		ASSERT_TRUE(res);
+		auto plain = mSplitter->ClientAdd();
+		ASSERT_TRUE(plain.IsValid());
+
+		const int frameCount = 10;
+		for (int i = 0; i < frameCount; i++)
+			ASSERT_EQ(mSplitter->Put(makeData(i), 0), 0);
+
+		// The executor runs the stages while nobody gets (a Get would run a stage not started yet itself).
+		const auto waitStart = steady_clock::now();
+		while (runs < frameCount && steady_clock::now() - waitStart < 5s)
+			this_thread::sleep_for(1ms);
+
+		// One run per frame, shared by both clients of the stage; the plain client is untouched.
+		for (int i = 0; i < frameCount; i++) {
+			Frame frame;
+			ASSERT_EQ(first.Get(frame, 1000), 0);
+			ASSERT_EQ(getDataAsInt(frame.data), i * 2);
+			ASSERT_EQ(frame.sequence, (uint64_t)i);
+
+			DataPtr data;
+			ASSERT_EQ(mSplitter->Get(secondId, data, 1000), 0);
+			ASSERT_EQ(data.get(), frame.data.get());
+
+			ASSERT_EQ(plain.Get(data, 0), 0);
+			ASSERT_EQ(getDataAsInt(data), i);
+		}
+		ASSERT_EQ(runs, frameCount);
+		ASSERT_FALSE(onPutThread);
+
+		ASSERT_EQ(mSplitter->PutBatch({ makeData(20), makeData(21) }, 0), 0);
+		DataPtrList dataList;
+		ASSERT_EQ(first.GetBatch(dataList, 10, 1000), 0);
+		ASSERT_EQ(dataList.size(), 2);
+		ASSERT_EQ(getDataAsInt(dataList[0]), 40);
+		ASSERT_EQ(getDataAsInt(dataList[1]), 42);
+		ASSERT_EQ(runs, frameCount + 2);
+
+		mSplitter.reset();
+	}
+
+	// A throwing stage hands its clients nullptr; frames read back from a spill file are
+	// transformed by Get.
+	mSplitter = ISplitter::Create(1, 2);
+
+	ISplitter::ClientOptions options;
+	options.transform = std::make_shared<const FrameTransform>([](const Frame& frame) -> DataPtr {
+		if (frame.sequence == 0)
+			throw std::runtime_error("bad frame");
+		return std::make_shared<DataArray>(DataArray{ (uint8_t)(frame.data->at(0) + 100) });
+	});
+	options.policy = ISplitter::OverflowPolicy::Spill;
+	options.spillPath = (std::filesystem::temp_directory_path() / "isplitter_test_transform.bin").string();
+	options.spillBytes = 4096;
+	auto client = mSplitter->ClientAdd(options);
+	ASSERT_TRUE(client.IsValid());
+
+	for (int i = 0; i < 4; i++)
+		ASSERT_EQ(mSplitter->Put(makeData(i), 0), 0);
+
+	DataPtr data;
+	ASSERT_EQ(client.Get(data, 1000), 0);
+	ASSERT_FALSE(data);
+	for (int i = 1; i < 4; i++) {
+		ASSERT_EQ(client.Get(data, 1000), 0);
+		ASSERT_EQ(getDataAsInt(data), i + 100);
+	}
+
+	// A stage is skipped once its frame was dropped or flushed: with the executor held up,
+	// a client keeping two frames only pays for those two.
+	mSplitter = ISplitter::Create(2, 1);
+	auto executor = Executor::Create(1);
+	mSplitter->SetExecutor(executor);
+
+	std::promise<void> blocked;
+	executor->Post([released = blocked.get_future().share()] { released.wait(); });
+	auto drainExecutor = [&executor] {
+		std::promise<void> drained;
+		executor->Post([&drained] { drained.set_value(); });
+		drained.get_future().wait();
+	};
+
+	std::atomic<int> runs{ 0 };
+	ISplitter::ClientOptions dropOptions;
+	dropOptions.policy = ISplitter::OverflowPolicy::DropOldest;
+	dropOptions.transform = std::make_shared<const FrameTransform>([&runs](const Frame& frame) {
+		runs++;
+		return frame.data;
+	});
+	client = mSplitter->ClientAdd(dropOptions);
+	ASSERT_TRUE(client.IsValid());
+
+	for (int i = 0; i < 20; i++)
+		mSplitter->Put(makeData(i), 0);
+	blocked.set_value();
+	drainExecutor();
+	ASSERT_EQ(runs, 2);
+
+	for (int i = 18; i < 20; i++) {
+		ASSERT_EQ(client.Get(data, 0), 0);
+		ASSERT_EQ(getDataAsInt(data), i);
+	}
+
+	std::promise<void> blockedAgain;
+	executor->Post([released = blockedAgain.get_future().share()] { released.wait(); });
+	for (int i = 0; i < 2; i++)
+		ASSERT_EQ(mSplitter->Put(makeData(i), 0), 0);
+	mSplitter->Flush();
+	blockedAgain.set_value();
+	drainExecutor();
+	ASSERT_EQ(runs, 2);
+}
+
+// A subscription on a single executor thread takes frames whose stage is still queued behind
+// its own delivery task; it runs the stage itself instead of waiting for it.
+TEST_F(TestISplitterMain, test_TransformStageSubscribe)
+{
+	mSplitter = ISplitter::Create(8, 1);
+	mSplitter->SetExecutor(Executor::Create(1));
+
+	ISplitter::ClientOptions options;
+	std::atomic<int> runs{ 0 };
+	options.transform = std::make_shared<const FrameTransform>([&runs](const Frame& frame) {
+		runs++;
+		return std::make_shared<DataArray>(DataArray{ (uint8_t)(frame.data->at(0) + 1) });
+	});
+	uint32_t clientId;
+	auto res = mSplitter->ClientAdd(&clientId, options);
+	ASSERT_TRUE(res);
+
+	struct Received {
+		std::mutex mutex;
+		std::condition_variable done;
+		IntList frames;
+	};
+	auto received = std::make_shared<Received>();
+	res = mSplitter->Subscribe(clientId, [received](int32_t errorId, const DataPtr& data) {
+		if (errorId)
+			return;
+
+		this_thread::sleep_for(20ms);
+		std::scoped_lock lock(received->mutex);
+		received->frames.push_back(data->at(0));
+		received->done.notify_all();
+	});
+	ASSERT_TRUE(res);
+
+	for (int i = 0; i < 5; i++)
+		ASSERT_EQ(mSplitter->Put(makeData(i), 0), 0);
+
+	std::unique_lock lock(received->mutex);
+	ASSERT_TRUE(received->done.wait_for(lock, 5s, [&received] { return received->frames.size() == 5; }));
+	for (int i = 0; i < 5; i++)
+		ASSERT_EQ(received->frames[i], i + 1);
+	ASSERT_EQ(runs, 5);
+}
+
+TEST_F(TestISplitterMain, test_ConsumerGroup)
+{
+	for (auto engine : { ISplitter::Engine::Queue, ISplitter::Engine::Ring, ISplitter::Engine::LockFreeQueue }) {
+		cout << "********* test_ConsumerGroup: engine = " << (int)engine << endl;
+
+		const int frameCount = 200;
+		mSplitter = ISplitter::Create(frameCount, 6, engine);
+
+		// A group of four consumers: the group client and three members, one of them joined
+		// through another member. Put serves the group and one ordinary client.
+		uint32_t groupId;
+		auto res = mSplitter->ClientAdd(&groupId);
+		ASSERT_TRUE(res);
+
+		ISplitter::ClientOptions options;
+		options.group = groupId;
+		std::vector<uint32_t> consumerIds{ groupId };
+		for (int i = 0; i < 3; i++) {
+			uint32_t memberId;
+			res = mSplitter->ClientAdd(&memberId, options);
+			ASSERT_TRUE(res);
+			consumerIds.push_back(memberId);
+			options.group = memberId;
+		}
+
+		uint32_t allId;
+		res = mSplitter->ClientAdd(&allId);
+		ASSERT_TRUE(res);
+
+		size_t count;
+		mSplitter->ClientGetCount(&count);
+		ASSERT_EQ(count, 2);
+
+		for (int i = 0; i < frameCount; i++)
+			ASSERT_EQ(mSplitter->Put(makeData(i), 0), 0);
+
+		ISplitter::ClientStats stats;
+		res = mSplitter->ClientGetStats(consumerIds[2], &stats);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(stats.latency, frameCount);
+
+		// Each frame goes to exactly one consumer of the group.
+		std::vector<IntList> received(consumerIds.size());
+		std::vector<std::thread> consumers;
+		for (size_t i = 0; i < consumerIds.size(); i++) {
+			consumers.emplace_back([this, &received, &consumerIds, i] {
+				DataPtr data;
+				while (mSplitter->Get(consumerIds[i], data, 0) == 0)
+					received[i].push_back(getDataAsInt(data));
+			});
+		}
+		for (auto& consumer : consumers)
+			consumer.join();
+
+		IntList all;
+		uint64_t delivered = 0;
+		for (size_t i = 0; i < consumerIds.size(); i++) {
+			ASSERT_TRUE(std::is_sorted(begin(received[i]), end(received[i])));
+			all.insert(end(all), begin(received[i]), end(received[i]));
+
+			res = mSplitter->ClientGetStats(consumerIds[i], &stats);
+			ASSERT_TRUE(res);
+			ASSERT_EQ(stats.endToEnd.count, received[i].size());
+			ASSERT_EQ(stats.latency, 0);
+			delivered += stats.endToEnd.count;
+		}
+		ASSERT_EQ(delivered, frameCount);
+		std::sort(begin(all), end(all));
+		for (int i = 0; i < frameCount; i++)
+			ASSERT_EQ(all[i], i & 0xff);
+
+		size_t latency;
+		size_t dropped;
+		res = mSplitter->ClientGetById(allId, &latency, &dropped);
+		ASSERT_TRUE(res);
+		ASSERT_EQ(latency, frameCount);
+
+		DataPtrList dataList;
+		ASSERT_EQ(mSplitter->GetBatch(allId, dataList, frameCount, 0), 0);
+		ASSERT_EQ(dataList.size(), frameCount);
+
+		// A waiting member gets a frame put later.
+		auto waiting = std::async(std::launch::async, [this, &consumerIds] {
+			DataPtr data;
+			auto error = mSplitter->Get(consumerIds[3], data, 5000);
+			return error ? -1 : getDataAsInt(data);
+		});
+		this_thread::sleep_for(20ms);
+		ASSERT_EQ(mSplitter->Put(makeData(7), 0), 0);
+		ASSERT_EQ(waiting.get(), 7);
+
+		// Members go with the group client, their slots are free again.
+		res = mSplitter->ClientRemove(consumerIds[1]);
+		ASSERT_TRUE(res);
+		res = mSplitter->ClientRemove(groupId);
+		ASSERT_TRUE(res);
+
+		DataPtr data;
+		ASSERT_EQ(mSplitter->Get(consumerIds[2], data, 0), (int32_t)ISplitter::Error::NoClientFound);
+		res = mSplitter->ClientGetStats(consumerIds[3], &stats);
+		ASSERT_FALSE(res);
+
+		for (int i = 0; i < 5; i++)
+			ASSERT_TRUE(mSplitter->ClientAdd().IsValid());
+		ASSERT_FALSE(mSplitter->ClientAdd().IsValid());
+	}
+
+	// A subscribed member receives the group's frames.
+	mSplitter = ISplitter::Create(4, 2);
+	mSplitter->SetExecutor(Executor::Create(1));
+
+	auto group = mSplitter->ClientAdd();
+	ASSERT_TRUE(group.IsValid());
+	ISplitter::ClientOptions options;
+	options.group = group.GetClientId();
+	uint32_t memberId;
+	auto res = mSplitter->ClientAdd(&memberId, options);
+	ASSERT_TRUE(res);
+
+	// The callback owns what it touches, the final call may come from any thread.
+	struct Received {
+		std::mutex mutex;
+		std::condition_variable done;
+		IntList frames;
+		bool ended = false;
+	};
+	auto received = std::make_shared<Received>();
+	res = mSplitter->Subscribe(memberId, [received](int32_t errorId, const DataPtr& data) {
+		std::scoped_lock lock(received->mutex);
+		if (errorId)
+			received->ended = true;
+		else
+			received->frames.push_back(data->at(0));
+		received->done.notify_all();
+	});
+	ASSERT_TRUE(res);
+
+	for (int i = 0; i < 10; i++)
+		ASSERT_EQ(mSplitter->Put(makeData(i), 1000), 0);
+
+	{
+		std::unique_lock lock(received->mutex);
+		ASSERT_TRUE(received->done.wait_for(lock, 5s, [&received] { return received->frames.size() == 10; }));
+		for (int i = 0; i < 10; i++)
+			ASSERT_EQ(received->frames[i], i);
+	}
+
+	// Destroying the splitter ends the member's subscription.
+	mSplitter = ISplitter::Create(4, 2);
+	{
+		std::unique_lock lock(received->mutex);
+		ASSERT_TRUE(received->done.wait_for(lock, 5s, [&received] { return received->ended; }));
+	}
+}